@@ -0,0 +1,90 @@
+// Measures compile throughput: source in, chunk out, through VM::compile as
+// the interpreter does it. Reports MB/s and the time per compile of each
+// script. With no scripts it compiles a generated script of a few megabytes.
+//
+// Usage: cpplox-compile-bench [-O1] [script.lox]...
+
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#include "common.h"
+#include "vm.h"
+
+VM vm;
+
+#define BYTES_PER_SOURCE (64 * 1024 * 1024)
+#define GENERATED_BLOCKS 20000
+// Generated blocks share globals, which are limited to 16 bits of slots.
+#define GENERATED_GLOBALS 64
+
+static std::string generated_source() {
+    std::string source {};
+    for (int i = 0; i < GENERATED_BLOCKS; i++) {
+        std::string n = std::to_string(i);
+        std::string global = "total_" + std::to_string(i % GENERATED_GLOBALS);
+        source += "// block " + n + "\n";
+        source += "var " + global + " = " + n + ";\n";
+        source += "{\n";
+        source += "    var label = \"block number " + n + "\";\n";
+        source += "    for (var i = 0; i < 10; i = i + 1) {\n";
+        source += "        if (i >= 5 and " + global + " != nil) " + global + " = " + global + " + i * 2.5;\n";
+        source += "        else { " + global + " = -(" + global + " - 1) / 3; }\n";
+        source += "    }\n";
+        source += "    while (!(" + global + " > 100 or false)) " + global + " = " + global + " * 2;\n";
+        source += "    print label + \" done\";\n";
+        source += "}\n";
+    }
+    return source;
+}
+
+static void bench_source(const std::string &name, const std::string &source) {
+    if (source.empty()) return;
+
+    size_t rounds = BYTES_PER_SOURCE / source.size() + 1;
+    size_t code_size = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (size_t round = 0; round < rounds; round++) {
+        std::shared_ptr<Chunk> chunk = vm.compile(source);
+        if (chunk == nullptr) {
+            std::cerr << name << ": compile error." << std::endl;
+            return;
+        }
+        code_size = chunk->size();
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    double seconds = std::chrono::duration<double>(end - start).count();
+    double megabytes = (double)rounds * source.size() / (1024 * 1024);
+    std::cout << name << ": " << source.size() << " bytes to " << code_size << " bytes of code, "
+              << megabytes / seconds << " MB/s, "
+              << seconds / rounds * 1e6 << " us per compile" << std::endl;
+}
+
+int main(int argc, const char* argv[]) {
+    int first_script = 1;
+    if (argc > 1 && strcmp(argv[1], "-O1") == 0) {
+        vm.m_optimization_level = 1;
+        first_script++;
+    }
+
+    if (first_script == argc) {
+        bench_source("generated", generated_source());
+        return 0;
+    }
+
+    for (int i = first_script; i < argc; i++) {
+        std::ifstream in {argv[i]};
+        if (!in.is_open()) {
+            std::cerr << "Could not open file " << argv[i] << "." << std::endl;
+            continue;
+        }
+        std::stringstream buffer;
+        buffer << in.rdbuf();
+        bench_source(argv[i], buffer.str());
+    }
+    return 0;
+}
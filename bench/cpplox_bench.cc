@@ -0,0 +1,403 @@
+// Runs .lox benchmarks through the interpreter and reports, per script, the
+// wall time, the CPU instructions retired and the peak RSS of the process as
+// JSON. Each run is a fresh process so that RSS and instruction counts are
+// the script's own. Given a baseline written by an earlier run, scripts whose
+// median wall time or instruction count grew by more than the threshold are
+// listed as regressions and the exit status is 1.
+//
+// Usage: cpplox-bench [--runs=N] [--warmup=N] [--threshold=PERCENT]
+//                     [--baseline=FILE] [--output=FILE]
+//                     [--interpreter=PATH] [--arg=ARG]... [script|dir]...
+//
+// --arg passes an option through to the interpreter, e.g.
+// --arg=--backend=register. Without scripts, the directories the build was
+// configured with (a colon-separated list) are run.
+//
+// Timings depend on the machine and the build, so no baseline is checked in.
+// To check a change, record one from a build of the code before it and
+// compare a build of the change against that on the same machine:
+//
+//   git stash && cmake --build build && build/cpplox-bench --output=base.json
+//   git stash pop && cmake --build build && build/cpplox-bench --baseline=base.json
+
+#include <fcntl.h>
+#include <linux/perf_event.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "util.h"
+
+#ifndef CPPLOX_BENCH_INTERPRETER
+#define CPPLOX_BENCH_INTERPRETER "cpplox"
+#endif
+#ifndef CPPLOX_BENCH_SCRIPTS
+#define CPPLOX_BENCH_SCRIPTS "example/benchmark"
+#endif
+
+struct Options {
+    int m_runs {5};
+    int m_warmup {1};
+    double m_threshold {5.0};
+    std::string m_baseline {};
+    std::string m_output {};
+    std::string m_interpreter {CPPLOX_BENCH_INTERPRETER};
+    std::vector<std::string> m_args {};
+    std::vector<std::string> m_paths {};
+};
+
+struct Sample {
+    double m_wall_ms {0};
+    // -1 when the kernel would not give us a hardware counter.
+    long long m_instructions {-1};
+    long m_peak_rss_kb {0};
+    int m_status {0};
+};
+
+struct Result {
+    std::string m_name {};
+    std::vector<double> m_wall_ms {};
+    std::vector<long long> m_instructions {};
+    long m_peak_rss_kb {0};
+    // Exit status of the first run that failed, or 0.
+    int m_status {0};
+
+    double median_wall_ms() const;
+    long long median_instructions() const;
+};
+
+template <typename T>
+static T median(std::vector<T> values) {
+    if (values.empty()) return T {};
+    std::sort(values.begin(), values.end());
+    return values[values.size() / 2];
+}
+
+double Result::median_wall_ms() const {
+    return median(m_wall_ms);
+}
+
+long long Result::median_instructions() const {
+    if (m_instructions.empty()) return -1;
+    return median(m_instructions);
+}
+
+// Counts user-space instructions of pid from its next exec on.
+static int open_instruction_counter(pid_t pid) {
+    perf_event_attr attr {};
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+    attr.disabled = 1;
+    attr.enable_on_exec = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return syscall(SYS_perf_event_open, &attr, pid, -1, -1, 0);
+}
+
+static Sample run_once(const Options &options, const std::string &script) {
+    std::vector<const char*> argv {options.m_interpreter.c_str()};
+    for (const std::string &arg : options.m_args) argv.push_back(arg.c_str());
+    argv.push_back(script.c_str());
+    argv.push_back(nullptr);
+
+    // The child waits on the pipe until the counter is attached, so that the
+    // exec that enables it has not happened yet.
+    int ready[2];
+    if (pipe(ready) < 0) {
+        perror("pipe");
+        exit(74);
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        exit(74);
+    }
+    if (pid == 0) {
+        close(ready[1]);
+        char byte;
+        if (read(ready[0], &byte, 1) < 0) _exit(127);
+        close(ready[0]);
+        int null = open("/dev/null", O_WRONLY);
+        dup2(null, STDOUT_FILENO);
+        execv(argv[0], const_cast<char* const*>(argv.data()));
+        _exit(127);
+    }
+
+    close(ready[0]);
+    int counter = open_instruction_counter(pid);
+    if (write(ready[1], "x", 1) < 0) perror("write");
+    close(ready[1]);
+
+    int status = 0;
+    rusage usage {};
+    wait4(pid, &status, 0, &usage);
+    auto end = std::chrono::steady_clock::now();
+
+    Sample sample {};
+    sample.m_wall_ms = std::chrono::duration<double, std::milli>(end - start).count();
+    sample.m_peak_rss_kb = usage.ru_maxrss;
+    sample.m_status = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+    if (counter >= 0) {
+        long long count;
+        if (read(counter, &count, sizeof(count)) == sizeof(count)) sample.m_instructions = count;
+        close(counter);
+    }
+    return sample;
+}
+
+static Result run_benchmark(const Options &options, const std::string &script) {
+    Result result {};
+    result.m_name = std::filesystem::path(script).filename().string();
+
+    for (int i = 0; i < options.m_warmup; i++) {
+        run_once(options, script);
+    }
+    for (int i = 0; i < options.m_runs; i++) {
+        Sample sample = run_once(options, script);
+        if (sample.m_status != 0) {
+            // Scripts that do not run yet are reported, not timed.
+            result.m_status = sample.m_status;
+            break;
+        }
+        result.m_wall_ms.push_back(sample.m_wall_ms);
+        if (sample.m_instructions >= 0) result.m_instructions.push_back(sample.m_instructions);
+        result.m_peak_rss_kb = std::max(result.m_peak_rss_kb, sample.m_peak_rss_kb);
+    }
+    return result;
+}
+
+static std::vector<std::string> collect_scripts(const std::vector<std::string> &paths) {
+    std::vector<std::string> scripts {};
+    for (const std::string &path : paths) {
+        if (!std::filesystem::is_directory(path)) {
+            scripts.push_back(path);
+            continue;
+        }
+        std::vector<std::string> found {};
+        for (const auto &entry : std::filesystem::directory_iterator(path)) {
+            if (entry.path().extension() == ".lox") found.push_back(entry.path().string());
+        }
+        std::sort(found.begin(), found.end());
+        scripts.insert(scripts.end(), found.begin(), found.end());
+    }
+    return scripts;
+}
+
+// Quotes text as a JSON string. Script names come from the file system, so
+// they can hold quotes, backslashes and control characters.
+static std::string json_string(const std::string &text) {
+    std::string quoted {"\""};
+    for (char c : text) {
+        if (c == '"' || c == '\\') {
+            quoted += '\\';
+            quoted += c;
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            quoted += string_format("\\u%04x", c);
+        } else {
+            quoted += c;
+        }
+    }
+    return quoted + '"';
+}
+
+// One benchmark per line, so that read_baseline() can stay line-based.
+static std::string to_json(const Options &options, const std::vector<Result> &results) {
+    std::stringstream out {};
+    out << "{\n";
+    out << string_format("  \"runs\": %d,\n  \"warmup\": %d,\n", options.m_runs, options.m_warmup);
+    out << "  \"benchmarks\": [\n";
+    for (size_t i = 0; i < results.size(); i++) {
+        const Result &result = results[i];
+        out << "    {\"name\": " << json_string(result.m_name);
+        out << string_format(", \"status\": %d", result.m_status);
+        if (result.m_status == 0) {
+            long long instructions = result.median_instructions();
+            out << string_format(", \"wall_ms\": %.3f, \"wall_ms_min\": %.3f",
+                                 result.median_wall_ms(),
+                                 *std::min_element(result.m_wall_ms.begin(), result.m_wall_ms.end()));
+            out << ", \"instructions\": ";
+            out << (instructions < 0 ? std::string {"null"} : std::to_string(instructions));
+            out << string_format(", \"peak_rss_kb\": %ld", result.m_peak_rss_kb);
+        }
+        out << (i + 1 < results.size() ? "},\n" : "}\n");
+    }
+    out << "  ]\n}\n";
+    return out.str();
+}
+
+struct Baseline {
+    double m_wall_ms {-1};
+    long long m_instructions {-1};
+};
+
+// Reads the JSON string starting after the opening quote at start, undoing
+// what json_string() escaped.
+static bool read_json_string(const std::string &line, size_t start, std::string &value) {
+    value.clear();
+    for (size_t i = start; i < line.size(); i++) {
+        char c = line[i];
+        if (c == '"') return true;
+        if (c != '\\') {
+            value += c;
+        } else if (i + 1 == line.size()) {
+            return false;
+        } else if (line[++i] == 'u') {
+            if (i + 4 >= line.size()) return false;
+            value += static_cast<char>(std::stoi(line.substr(i + 1, 4), nullptr, 16));
+            i += 4;
+        } else {
+            value += line[i];
+        }
+    }
+    return false;
+}
+
+static bool find_field(const std::string &line, const char* key, std::string &value) {
+    std::string pattern = std::string {"\""} + key + "\": ";
+    size_t start = line.find(pattern);
+    if (start == std::string::npos) return false;
+    start += pattern.size();
+    if (start < line.size() && line[start] == '"') return read_json_string(line, start + 1, value);
+    size_t end = line.find_first_of(",}", start);
+    value = line.substr(start, end - start);
+    return true;
+}
+
+// Reads back the benchmark lines of a file written by to_json().
+static std::map<std::string, Baseline> read_baseline(const std::string &path) {
+    std::ifstream in {path};
+    if (!in.is_open()) {
+        std::cerr << "Could not open baseline " << path << "." << std::endl;
+        exit(74);
+    }
+
+    std::map<std::string, Baseline> baseline {};
+    for (std::string line; std::getline(in, line);) {
+        std::string name, wall_ms, instructions;
+        if (!find_field(line, "name", name) || !find_field(line, "wall_ms", wall_ms)) continue;
+        Baseline &entry = baseline[name];
+        entry.m_wall_ms = std::stod(wall_ms);
+        if (find_field(line, "instructions", instructions) && instructions != "null") {
+            entry.m_instructions = std::stoll(instructions);
+        }
+    }
+    return baseline;
+}
+
+static double percent_change(double before, double after) {
+    return (after - before) / before * 100.0;
+}
+
+// Prints a comparison table to stderr and returns how many scripts regressed.
+static int compare(const Options &options, const std::vector<Result> &results) {
+    std::map<std::string, Baseline> baseline = read_baseline(options.m_baseline);
+    int regressions = 0;
+
+    std::cerr << string_format("%-24s %12s %12s %9s %9s\n", "benchmark", "base ms", "ms", "time", "instrs");
+    for (const Result &result : results) {
+        auto found = baseline.find(result.m_name);
+        if (result.m_status != 0 || found == baseline.end()) continue;
+        const Baseline &before = found->second;
+
+        double time_change = percent_change(before.m_wall_ms, result.median_wall_ms());
+        bool regressed = time_change > options.m_threshold;
+        std::string instruction_change {"-"};
+        long long instructions = result.median_instructions();
+        if (before.m_instructions > 0 && instructions >= 0) {
+            double change = percent_change(before.m_instructions, instructions);
+            instruction_change = string_format("%+.1f%%", change);
+            regressed = regressed || change > options.m_threshold;
+        }
+
+        std::cerr << string_format("%-24s %12.3f %12.3f %+8.1f%% %9s%s\n", result.m_name.c_str(),
+                                   before.m_wall_ms, result.median_wall_ms(), time_change,
+                                   instruction_change.c_str(), regressed ? "  REGRESSION" : "");
+        if (regressed) regressions++;
+    }
+    return regressions;
+}
+
+static void usage() {
+    std::cerr << "Usage: cpplox-bench [--runs=N] [--warmup=N] [--threshold=PERCENT] "
+                 "[--baseline=FILE] [--output=FILE] [--interpreter=PATH] [--arg=ARG]... "
+                 "[script|dir]...\n";
+    exit(64);
+}
+
+static bool option_value(const char* arg, const char* name, std::string &value) {
+    size_t length = strlen(name);
+    if (strncmp(arg, name, length) != 0 || arg[length] != '=') return false;
+    value = arg + length + 1;
+    return true;
+}
+
+int main(int argc, const char* argv[]) {
+    Options options {};
+    for (int i = 1; i < argc; i++) {
+        std::string value {};
+        if (option_value(argv[i], "--runs", value)) {
+            options.m_runs = std::max(1, std::stoi(value));
+        } else if (option_value(argv[i], "--warmup", value)) {
+            options.m_warmup = std::max(0, std::stoi(value));
+        } else if (option_value(argv[i], "--threshold", value)) {
+            options.m_threshold = std::stod(value);
+        } else if (option_value(argv[i], "--baseline", value)) {
+            options.m_baseline = value;
+        } else if (option_value(argv[i], "--output", value)) {
+            options.m_output = value;
+        } else if (option_value(argv[i], "--interpreter", value)) {
+            options.m_interpreter = value;
+        } else if (option_value(argv[i], "--arg", value)) {
+            options.m_args.push_back(value);
+        } else if (argv[i][0] != '-') {
+            options.m_paths.push_back(argv[i]);
+        } else {
+            usage();
+        }
+    }
+    if (options.m_paths.empty()) {
+        std::stringstream defaults {CPPLOX_BENCH_SCRIPTS};
+        for (std::string path; std::getline(defaults, path, ':');) options.m_paths.push_back(path);
+    }
+
+    std::vector<Result> results {};
+    for (const std::string &script : collect_scripts(options.m_paths)) {
+        results.push_back(run_benchmark(options, script));
+        const Result &result = results.back();
+        if (result.m_status != 0) {
+            std::cerr << result.m_name << ": exited with status " << result.m_status << std::endl;
+        }
+    }
+
+    std::string json = to_json(options, results);
+    if (options.m_output.empty()) {
+        std::cout << json;
+    } else {
+        std::ofstream out {options.m_output};
+        out << json;
+        if (!out) {
+            std::cerr << "Could not write file " << options.m_output << "." << std::endl;
+            return 74;
+        }
+    }
+
+    if (!options.m_baseline.empty() && compare(options, results) > 0) {
+        return 1;
+    }
+    return 0;
+}
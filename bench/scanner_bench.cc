@@ -0,0 +1,79 @@
+// Measures Scanner throughput in MB/s by scanning each script to the end
+// repeatedly. With no arguments it scans a generated script of a few
+// megabytes that mixes declarations, loops, strings and comments.
+//
+// Usage: cpplox-scanner-bench [script.lox]...
+
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#include "common.h"
+#include "scanner.h"
+#include "vm.h"
+
+VM vm;
+
+#define BYTES_PER_SOURCE (256 * 1024 * 1024)
+#define GENERATED_BLOCKS 40000
+
+static std::string generated_source() {
+    std::string source {};
+    for (int i = 0; i < GENERATED_BLOCKS; i++) {
+        std::string n = std::to_string(i);
+        source += "// block " + n + " sums a few numbers and builds a string\n";
+        source += "var total_" + n + " = 0;\n";
+        source += "var label_" + n + " = \"block number " + n + "\";\n";
+        source += "for (var i = 0; i < " + n + "; i = i + 1) {\n";
+        source += "    if (i >= 10 and total_" + n + " != nil) total_" + n + " = total_" + n + " + i * 2.5;\n";
+        source += "    else { total_" + n + " = total_" + n + " - 1; }\n";
+        source += "}\n";
+        source += "print label_" + n + " + \" done\";\n\n";
+    }
+    return source;
+}
+
+static void bench_source(const std::string &name, const std::string &source) {
+    if (source.empty()) return;
+
+    size_t rounds = BYTES_PER_SOURCE / source.size() + 1;
+    size_t tokens = 0;
+    int lines = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (size_t round = 0; round < rounds; round++) {
+        Scanner scanner {source};
+        Token token;
+        do {
+            token = scanner.scan_token();
+            tokens++;
+        } while (token.type != TOKEN_EOF);
+        lines = token.line;
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    double seconds = std::chrono::duration<double>(end - start).count();
+    double megabytes = (double)rounds * source.size() / (1024 * 1024);
+    std::cout << name << ": " << source.size() << " bytes, " << lines << " lines, "
+              << tokens / rounds << " tokens, " << megabytes / seconds << " MB/s" << std::endl;
+}
+
+int main(int argc, const char* argv[]) {
+    if (argc < 2) {
+        bench_source("generated", generated_source());
+        return 0;
+    }
+
+    for (int i = 1; i < argc; i++) {
+        std::ifstream in {argv[i]};
+        if (!in.is_open()) {
+            std::cerr << "Could not open file " << argv[i] << "." << std::endl;
+            continue;
+        }
+        std::stringstream buffer;
+        buffer << in.rdbuf();
+        bench_source(argv[i], buffer.str());
+    }
+    return 0;
+}
@@ -0,0 +1,102 @@
+// Compares the VM's Table against the std::unordered_map it replaced by
+// replaying the identifier accesses of each script as global lookups.
+//
+// Usage: cpplox-table-bench <script.lox>...
+
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <unordered_map>
+
+#include "common.h"
+#include "scanner.h"
+#include "table.h"
+#include "vm.h"
+#include "objects/objstring.h"
+
+VM vm;
+
+#define LOOKUPS_PER_FILE 20000000
+
+template <typename Fn>
+static double time_ns_per_lookup(size_t lookups, Fn fn) {
+    auto start = std::chrono::steady_clock::now();
+    fn();
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::nano>(end - start).count() / lookups;
+}
+
+static void bench_file(const char* path) {
+    std::ifstream in {path};
+    if (!in.is_open()) {
+        std::cerr << "Could not open file " << path << "." << std::endl;
+        return;
+    }
+    std::stringstream buffer;
+    buffer << in.rdbuf();
+    std::string source {buffer.str()};
+
+    // Every identifier in the script stands in for one global access. Each
+    // name is also declared as a VM global, which keeps it alive: the next
+    // copy_string() may collect garbage, and accesses is not a root.
+    std::vector<ObjString*> accesses {};
+    Scanner scanner {source};
+    for (Token token = scanner.scan_token(); token.type != TOKEN_EOF; token = scanner.scan_token()) {
+        if (token.type == TOKEN_IDENTIFIER) {
+            ObjString* name = ObjString::copy_string(token.start, token.length);
+            vm.global_slot(name);
+            accesses.push_back(name);
+        }
+    }
+    if (accesses.empty()) return;
+
+    Table table {};
+    std::unordered_map<std::string, Value> map {};
+    std::vector<std::string> access_names {};
+    for (ObjString* name : accesses) {
+        table.set(name, NUMBER_VAL(1.0));
+        access_names.emplace_back(name->view());
+        map[access_names.back()] = NUMBER_VAL(1.0);
+    }
+
+    size_t rounds = LOOKUPS_PER_FILE / accesses.size() + 1;
+    size_t lookups = rounds * accesses.size();
+    double table_sum = 0;
+    double map_sum = 0;
+
+    double table_ns = time_ns_per_lookup(lookups, [&] {
+        for (size_t round = 0; round < rounds; round++) {
+            for (ObjString* name : accesses) {
+                Value value {};
+                if (table.get(name, value)) table_sum += AS_NUMBER(value);
+            }
+        }
+    });
+    double map_ns = time_ns_per_lookup(lookups, [&] {
+        for (size_t round = 0; round < rounds; round++) {
+            for (const std::string &name : access_names) {
+                map_sum += AS_NUMBER(map.at(name));
+            }
+        }
+    });
+
+    if (table_sum != map_sum) {
+        std::cerr << path << ": lookup results differ." << std::endl;
+    }
+    std::cout << path << ": " << accesses.size() << " accesses, "
+              << table.count() << " names, table " << table_ns << " ns, "
+              << "unordered_map " << map_ns << " ns, "
+              << "speedup " << map_ns / table_ns << "x" << std::endl;
+}
+
+int main(int argc, const char* argv[]) {
+    if (argc < 2) {
+        std::cerr << "Usage: cpplox-table-bench <script.lox>...\n";
+        exit(64);
+    }
+
+    for (int i = 1; i < argc; i++) {
+        bench_file(argv[i]);
+    }
+    return 0;
+}
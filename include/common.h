@@ -7,6 +7,3 @@
 #include <vector>
 #include <map>
 #include <iostream>
-
-#define DEBUG_TRACE_EXECUTION
-#define DEBUG_PRINT_CODE
\ No newline at end of file
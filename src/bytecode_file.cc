@@ -0,0 +1,316 @@
+#include <cstring>
+#include <fstream>
+
+#include "bytecode_file.h"
+#include "optimizer.h"
+#include "vm.h"
+#include "objects/objstring.h"
+
+namespace {
+
+template <typename T>
+void put(std::string &out, const T &value) {
+    out.append(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+void put_string(std::string &out, std::string_view string) {
+    put<uint32_t>(out, string.size());
+    out.append(string);
+}
+
+// Reads fields out of the payload, failing once it runs past the end.
+struct Reader {
+    const uint8_t* m_current;
+    const uint8_t* m_end;
+
+    bool has(size_t size) const {
+        return static_cast<size_t>(m_end - m_current) >= size;
+    }
+
+    template <typename T>
+    bool get(T &value) {
+        if (!has(sizeof(T))) return false;
+        std::memcpy(&value, m_current, sizeof(T));
+        m_current += sizeof(T);
+        return true;
+    }
+
+    bool get_string(std::string_view &string) {
+        uint32_t length;
+        if (!get(length) || !has(length)) return false;
+        string = std::string_view {reinterpret_cast<const char*>(m_current), length};
+        m_current += length;
+        return true;
+    }
+};
+
+// How many values an instruction pops, then pushes.
+struct StackEffect {
+    int pops;
+    int pushes;
+};
+
+StackEffect stack_effect(uint8_t op) {
+    switch (op) {
+        case OP_CONSTANT:
+        case OP_CONSTANT_LONG:
+        case OP_NIL:
+        case OP_TRUE:
+        case OP_FALSE:
+        case OP_GET_LOCAL:
+        case OP_GET_GLOBAL:
+        case OP_ADD_LOCAL_CONSTANT:
+        case OP_SUBTRACT_LOCAL_CONSTANT:
+            return {0, 1};
+        case OP_SET_LOCAL:
+        case OP_SET_GLOBAL:
+        case OP_NOT:
+        case OP_NEGATE:
+        case OP_JUMP_IF_FALSE:
+            return {1, 1};
+        case OP_POP:
+        case OP_DEFINE_GLOBAL:
+        case OP_PRINT:
+        case OP_POP_JUMP_IF_FALSE:
+            return {1, 0};
+        case OP_EQUAL:
+        case OP_NOT_EQUAL:
+        case OP_GREATER:
+        case OP_GREATER_EQUAL:
+        case OP_LESS:
+        case OP_LESS_EQUAL:
+        case OP_ADD:
+        case OP_SUBTRACT:
+        case OP_MULTIPLY:
+        case OP_DIVIDE:
+            return {2, 1};
+        case OP_LESS_JUMP_IF_FALSE:
+        case OP_LESS_EQUAL_JUMP_IF_FALSE:
+        case OP_GREATER_JUMP_IF_FALSE:
+        case OP_GREATER_EQUAL_JUMP_IF_FALSE:
+            return {2, 0};
+        default:
+            return {0, 0};
+    }
+}
+
+// The slot of an instruction that reads or writes a local, or -1.
+int local_slot(const DecodedInstruction &instruction) {
+    switch (instruction.op) {
+        case OP_GET_LOCAL:
+        case OP_SET_LOCAL:
+            return instruction.operand;
+        case OP_ADD_LOCAL_CONSTANT:
+        case OP_SUBTRACT_LOCAL_CONSTANT:
+            return instruction.operand >> 8;
+        default:
+            return -1;
+    }
+}
+
+// The constant an instruction loads, or -1.
+int64_t constant_index(const DecodedInstruction &instruction) {
+    switch (instruction.op) {
+        case OP_CONSTANT:
+        case OP_CONSTANT_LONG:
+            return instruction.operand;
+        case OP_ADD_LOCAL_CONSTANT:
+        case OP_SUBTRACT_LOCAL_CONSTANT:
+            return instruction.operand & 0xff;
+        default:
+            return -1;
+    }
+}
+
+bool is_global_op(uint8_t op) {
+    return op == OP_GET_GLOBAL || op == OP_SET_GLOBAL || op == OP_DEFINE_GLOBAL;
+}
+
+// The VM runs mapped code without checking operands, and a checksum only
+// catches accidents, so the code is checked the way the compiler would have
+// produced it: whole instructions, operands that index the file's own
+// constants and globals, jumps onto instruction boundaries, and a stack that
+// never underflows or grows past STACK_MAX and is the same height on every
+// path into an instruction. Locals must lie below the top of the stack.
+bool verify_code(const uint8_t* bytes, const LoxcHeader &loxc, const std::vector<LineStart> &lines) {
+    if (loxc.code_size > INT32_MAX) return false;
+    std::vector<DecodedInstruction> code {};
+    if (!decode_code(bytes, loxc.code_size, lines, 0, code)) return false;
+    if (code.empty() || code.back().op != OP_RETURN) return false;
+
+    for (const DecodedInstruction &instruction : code) {
+        if (constant_index(instruction) >= static_cast<int64_t>(loxc.constant_count)) return false;
+        if (is_global_op(instruction.op) && instruction.operand >= loxc.global_count) return false;
+    }
+
+    std::vector<int> depth_at(code.size(), -1);
+    std::vector<size_t> pending {0};
+    depth_at[0] = 0;
+    auto reach = [&](size_t index, int depth) {
+        if (depth_at[index] == -1) {
+            depth_at[index] = depth;
+            pending.push_back(index);
+        }
+        return depth_at[index] == depth;
+    };
+
+    while (!pending.empty()) {
+        size_t index = pending.back();
+        pending.pop_back();
+        const DecodedInstruction &instruction = code[index];
+        int depth = depth_at[index];
+
+        if (local_slot(instruction) >= depth) return false;
+        StackEffect effect = stack_effect(instruction.op);
+        if (effect.pops > depth) return false;
+        depth += effect.pushes - effect.pops;
+        if (depth > STACK_MAX) return false;
+
+        if (is_jump_op(instruction.op) && !reach(instruction.target, depth)) return false;
+        bool falls_through = instruction.op != OP_JUMP && instruction.op != OP_LOOP &&
+                             instruction.op != OP_RETURN;
+        // Only OP_RETURN may end the code, and it is last.
+        if (falls_through && !reach(index + 1, depth)) return false;
+    }
+    return true;
+}
+
+}
+
+bool write_bytecode(const Chunk &chunk, const std::vector<ObjString*> &global_names,
+                    const char* path, std::string &error) {
+    std::string payload {};
+    payload.append(reinterpret_cast<const char*>(chunk.data()), chunk.size());
+
+    for (const LineStart &start : chunk.lines()) {
+        put<int32_t>(payload, start.offset);
+        put<int32_t>(payload, start.line);
+    }
+
+    for (const Value &constant : chunk.constants()) {
+        if (IS_NUMBER(constant)) {
+            put<uint8_t>(payload, LOXC_NUMBER);
+            put<double>(payload, AS_NUMBER(constant));
+        } else if (IS_STRING(constant)) {
+            put<uint8_t>(payload, LOXC_STRING);
+            put_string(payload, AS_STRING(constant)->view());
+        } else if (IS_NIL(constant)) {
+            put<uint8_t>(payload, LOXC_NIL);
+        } else if (IS_BOOL(constant)) {
+            put<uint8_t>(payload, AS_BOOL(constant) ? LOXC_TRUE : LOXC_FALSE);
+        } else {
+            error = "Constant cannot be serialized.";
+            return false;
+        }
+    }
+
+    for (const ObjString* name : global_names) {
+        put_string(payload, name->view());
+    }
+
+    LoxcHeader header {
+        LOXC_MAGIC,
+        LOXC_VERSION,
+        static_cast<uint32_t>(chunk.size()),
+        static_cast<uint32_t>(chunk.lines().size()),
+        static_cast<uint32_t>(chunk.constants().size()),
+        static_cast<uint32_t>(global_names.size()),
+        static_cast<uint32_t>(payload.size()),
+        ObjString::hash_string(payload.data(), payload.size()),
+    };
+
+    std::ofstream out {path, std::ios::binary | std::ios::trunc};
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.write(payload.data(), payload.size());
+    if (!out) {
+        error = std::string {"Could not write file "} + path + ".";
+        return false;
+    }
+    return true;
+}
+
+bool MappedBytecode::open(const char* path, std::string &error) {
+    if (!m_file.open(path)) {
+        error = std::string {"Could not open file "} + path + ".";
+        return false;
+    }
+    if (m_file.size() < sizeof(LoxcHeader)) {
+        error = std::string {"Not a bytecode file: "} + path + ".";
+        return false;
+    }
+
+    const LoxcHeader &loxc = header();
+    if (loxc.magic != LOXC_MAGIC) {
+        error = std::string {"Not a bytecode file: "} + path + ".";
+        return false;
+    }
+    if (loxc.version != LOXC_VERSION) {
+        error = std::string {"Bytecode file "} + path + " was written by another version.";
+        return false;
+    }
+    if (loxc.payload_size != m_file.size() - sizeof(LoxcHeader) || loxc.code_size > loxc.payload_size ||
+        loxc.checksum != ObjString::hash_string(reinterpret_cast<const char*>(code()), loxc.payload_size)) {
+        error = std::string {"Bytecode file "} + path + " is corrupt.";
+        return false;
+    }
+    return true;
+}
+
+bool MappedBytecode::load(Chunk &chunk, VM &vm, std::string &error) const {
+    const LoxcHeader &loxc = header();
+    Reader reader {code() + loxc.code_size, m_file.data() + m_file.size()};
+    error = "Bytecode file is corrupt.";
+
+    for (uint32_t i = 0; i < loxc.line_count; i++) {
+        LineStart start;
+        if (!reader.get(start.offset) || !reader.get(start.line)) return false;
+        chunk.add_line_start(start);
+    }
+
+    for (uint32_t i = 0; i < loxc.constant_count; i++) {
+        uint8_t tag;
+        if (!reader.get(tag)) return false;
+        switch (tag) {
+            case LOXC_NUMBER: {
+                double number;
+                if (!reader.get(number)) return false;
+                chunk.add_constant(NUMBER_VAL(number));
+                break;
+            }
+            case LOXC_STRING: {
+                std::string_view string;
+                if (!reader.get_string(string)) return false;
+                chunk.add_constant(OBJ_VAL(ObjString::copy_string(string.data(), string.size())));
+                break;
+            }
+            case LOXC_NIL: chunk.add_constant(NIL_VAL); break;
+            case LOXC_TRUE: chunk.add_constant(BOOL_VAL(true)); break;
+            case LOXC_FALSE: chunk.add_constant(BOOL_VAL(false)); break;
+            default: return false;
+        }
+    }
+    if (chunk.constants().size() != loxc.constant_count) return false;
+    if (!verify_code(code(), loxc, chunk.lines())) return false;
+
+    // The code names globals by slot, so they have to land in the same slots.
+    for (uint32_t i = 0; i < loxc.global_count; i++) {
+        std::string_view name;
+        if (!reader.get_string(name)) return false;
+        int slot = vm.global_slot(ObjString::copy_string(name.data(), name.size()));
+        if (static_cast<uint32_t>(slot) != i) {
+            error = "Bytecode globals do not match the VM's.";
+            return false;
+        }
+    }
+
+    error.clear();
+    return true;
+}
+
+const uint8_t* MappedBytecode::code() const {
+    return m_file.data() + sizeof(LoxcHeader);
+}
+
+const LoxcHeader& MappedBytecode::header() const {
+    return *reinterpret_cast<const LoxcHeader*>(m_file.data());
+}
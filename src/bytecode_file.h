@@ -0,0 +1,63 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "chunk.h"
+#include "mapped_file.h"
+
+struct ObjString;
+struct VM;
+
+#define LOXC_MAGIC 0x43584f4c // "LOXC"
+// Bump whenever the OpCode numbering or the file layout changes.
+#define LOXC_VERSION 1
+
+// A .loxc file is this header followed by the sections it describes, in
+// order: the code bytes, the line table as pairs of int32 offset and line,
+// the constants, and the names of the globals the code refers to by slot.
+// Constants are a one-byte tag followed by a double for numbers or a uint32
+// length and the characters for strings. Global names are stored like string
+// constants without the tag. All fields are in host byte order; the checksum
+// is FNV-1a over everything after the header.
+struct LoxcHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t code_size;
+    uint32_t line_count;
+    uint32_t constant_count;
+    uint32_t global_count;
+    uint32_t payload_size;
+    uint32_t checksum;
+};
+
+enum LoxcConstant : uint8_t {
+    LOXC_NUMBER,
+    LOXC_STRING,
+    LOXC_NIL,
+    LOXC_TRUE,
+    LOXC_FALSE,
+};
+
+// Writes chunk and the names of the global slots to path.
+bool write_bytecode(const Chunk &chunk, const std::vector<ObjString*> &global_names,
+                    const char* path, std::string &error);
+
+// A .loxc file mapped read-only into memory. The VM executes the code
+// straight out of the mapping; only the constants and global names are
+// turned into objects.
+struct MappedBytecode {
+    // Maps path and checks its header and checksum.
+    bool open(const char* path, std::string &error);
+
+    // Fills chunk's constants and line table and binds the global names to
+    // slots in vm. The code itself stays in the mapping; see code().
+    bool load(Chunk &chunk, VM &vm, std::string &error) const;
+
+    const uint8_t* code() const;
+
+private:
+    MappedFile m_file {};
+
+    const LoxcHeader& header() const;
+};
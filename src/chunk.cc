@@ -1,3 +1,5 @@
+#include <algorithm>
+#include <bit>
 #include <sstream>
 
 #include "chunk.h"
@@ -24,13 +26,64 @@ const ValueArray& Chunk::constants() const {
     return m_constants;
 }
 
-const std::vector<int>& Chunk::lines() const {
+const std::vector<LineStart>& Chunk::lines() const {
     return m_lines;
 }
 
-int Chunk::get_line(uint8_t offset) const {
-    for (int i = 0; i < m_lines.size(); i++) {
-        if (m_lines.at(i) > offset) return i;
+int Chunk::get_line(int offset) const {
+    // Find the last run starting at or before offset.
+    auto run = std::upper_bound(m_lines.begin(), m_lines.end(), offset,
+        [](int offset, const LineStart &start) { return offset < start.offset; });
+    if (run == m_lines.begin()) return 0;
+    return std::prev(run)->line;
+}
+
+int Chunk::add_constant(const Value &value) {
+    if (IS_NUMBER(value)) {
+        uint64_t bits = std::bit_cast<uint64_t>(AS_NUMBER(value));
+        auto [found, inserted] = m_number_constants.try_emplace(bits, m_constants.size());
+        if (!inserted) return found->second;
+    } else if (IS_OBJ(value)) {
+        auto [found, inserted] = m_object_constants.try_emplace(AS_OBJ(value), m_constants.size());
+        if (!inserted) return found->second;
+    } else if (int* literal = literal_constant(value)) {
+        if (*literal >= 0) return *literal;
+        *literal = m_constants.size();
     }
-    return m_lines.size();
-}
\ No newline at end of file
+
+    m_constants.push_back(value);
+
+    // Return the index of the new value
+    return m_constants.size() - 1;
+}
+
+void Chunk::add_line_start(const LineStart &start) {
+    m_lines.push_back(start);
+}
+
+void Chunk::truncate_code(int offset) {
+    resize(offset);
+    while (!m_lines.empty() && m_lines.back().offset >= offset) {
+        m_lines.pop_back();
+    }
+}
+
+void Chunk::truncate_constants(int count) {
+    for (size_t i = count; i < m_constants.size(); i++) {
+        Value value = m_constants[i];
+        if (IS_NUMBER(value)) {
+            m_number_constants.erase(std::bit_cast<uint64_t>(AS_NUMBER(value)));
+        } else if (IS_OBJ(value)) {
+            m_object_constants.erase(AS_OBJ(value));
+        } else if (int* literal = literal_constant(value)) {
+            *literal = -1;
+        }
+    }
+    m_constants.resize(count);
+}
+
+int* Chunk::literal_constant(const Value &value) {
+    if (IS_NIL(value)) return &m_literal_constants[0];
+    if (IS_BOOL(value)) return &m_literal_constants[AS_BOOL(value) ? 2 : 1];
+    return nullptr;
+}
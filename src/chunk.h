@@ -1,12 +1,25 @@
 #pragma once
 
+#include <unordered_map>
+
 #include "common.h"
 #include "debug.h"
 #include "value.h"
 #include "value_array.h"
 
+// Largest index OP_CONSTANT_LONG can address.
+#define MAX_CONSTANTS 0xffffff
+
+// Start of a run of bytecode that came from the same source line.
+struct LineStart {
+    int offset;
+    int line;
+};
+
 enum OpCode {
     OP_CONSTANT,
+    // 24-bit constant index, for chunks with more than 256 constants.
+    OP_CONSTANT_LONG,
 
     // Optimized Values
     OP_NIL,
@@ -23,8 +36,11 @@ enum OpCode {
 
     // Equality and Comparison
     OP_EQUAL,
+    OP_NOT_EQUAL,
     OP_GREATER,
+    OP_GREATER_EQUAL,
     OP_LESS,
+    OP_LESS_EQUAL,
 
     // Binary
     OP_ADD,
@@ -40,15 +56,44 @@ enum OpCode {
     OP_PRINT,
     OP_JUMP,
     OP_JUMP_IF_FALSE,
+    // Pops the condition, so `if` and loops need no OP_POP on either branch.
+    OP_POP_JUMP_IF_FALSE,
     OP_LOOP,
     OP_RETURN,
+
+    // Superinstructions, selected by fuse_superinstructions() in place of
+    // common sequences. The local/constant forms take a slot and a constant
+    // index; the compare-and-branch forms pop both operands and take a jump
+    // offset.
+    OP_ADD_LOCAL_CONSTANT,
+    OP_SUBTRACT_LOCAL_CONSTANT,
+    OP_LESS_JUMP_IF_FALSE,
+    OP_LESS_EQUAL_JUMP_IF_FALSE,
+    OP_GREATER_JUMP_IF_FALSE,
+    OP_GREATER_EQUAL_JUMP_IF_FALSE,
 };
 
+#define OPCODE_COUNT (OP_GREATER_EQUAL_JUMP_IF_FALSE + 1)
+
 struct Chunk: std::vector<uint8_t> {
 private:
     std::string m_name {"unnamed chunk"};
     ValueArray m_constants {};
-    std::vector<int> m_lines {};
+    // Run-length encoded line table, ordered by offset: one entry per change
+    // of line rather than per byte or per source line.
+    std::vector<LineStart> m_lines {};
+
+    // Indices of constants already in the pool. Numbers are keyed by their
+    // bit pattern so that 0 and -0 stay distinct; strings are interned, so
+    // their pointer identifies their contents.
+    std::unordered_map<uint64_t, int> m_number_constants {};
+    std::unordered_map<Obj*, int> m_object_constants {};
+    // Indices of nil, false and true, or -1 while they are not in the pool.
+    int m_literal_constants[3] {-1, -1, -1};
+
+    // The m_literal_constants entry for value, or nullptr if it is not a
+    // literal.
+    int* literal_constant(const Value &value);
 
 public:
     Chunk(std::string name);
@@ -59,21 +104,26 @@ public:
 
     std::string name() const;
     const ValueArray& constants() const;
-    const std::vector<int>& lines() const;
-    int get_line(uint8_t offset) const;
+    const std::vector<LineStart>& lines() const;
+    int get_line(int offset) const;
 
     inline void write_chunk(uint8_t byte, int line) {
-        this->push_back(byte);
-        if (line >= m_lines.size()) {
-            m_lines.resize(line+1);
+        if (m_lines.empty() || m_lines.back().line != line) {
+            m_lines.push_back({static_cast<int>(this->size()), line});
         }
-        m_lines.at(line) = this->size();
+        this->push_back(byte);
     }
 
-    inline int add_constant(Value &value) {
-        m_constants.push_back(std::move(value));
+    int add_constant(const Value &value);
 
-        // Return the index of the new value
-        return m_constants.size() - 1; 
-    }
+    // Appends a line table entry directly, for chunks whose code lives
+    // elsewhere (see MappedBytecode).
+    void add_line_start(const LineStart &start);
+
+    // Drops the bytecode from offset on, with its line information, but keeps
+    // the constant pool, so that the code can be re-emitted.
+    void truncate_code(int offset);
+
+    // Drops the constants from index count on. Nothing may still refer to them.
+    void truncate_constants(int count);
 };
@@ -1,4 +1,5 @@
 #include <stdio.h>
+#include <charconv>
 #include <cstring>
 
 #include "common.h"
@@ -6,23 +7,28 @@
 #include "scanner.h"
 #include "chunk.h"
 #include "parser.h"
+#include "optimizer.h"
+#include "vm.h"
 #include "objects/object.h"
 #include "objects/objstring.h"
 
 
-#ifdef DEBUG_PRINT_CODE
 #include "debug.h"
-#endif
 
+extern VM vm;
 
-Compiler::Compiler() {
+
+Compiler::Compiler(int optimization_level, bool print_code):
+m_optimization_level(optimization_level), m_print_code(print_code) {
     m_locals.reserve(256); 
 }
 
-bool Compiler::compile(const std::string &source, std::shared_ptr<Chunk> chunk) {
+bool Compiler::compile(std::string_view source, std::shared_ptr<Chunk> chunk) {
     m_scanner = std::make_shared<Scanner>(source);
     m_parser = std::make_unique<Parser>(m_scanner, *this);
     m_compiling_chunk = chunk;
+    m_unit_start = chunk->size();
+    m_constant_start = chunk->constants().size();
     advance();
 
     while (!match(TOKEN_EOF)) {
@@ -32,7 +38,13 @@ bool Compiler::compile(const std::string &source, std::shared_ptr<Chunk> chunk)
     // consume(TOKEN_EOF, "Expect end of expression.");
 
     end_compiler();
-    return !m_parser->had_error();
+    if (m_parser->had_error()) {
+        // Leave the chunk as it was, so earlier code appended to it stays valid.
+        chunk->truncate_code(m_unit_start);
+        chunk->truncate_constants(m_constant_start);
+        return false;
+    }
+    return true;
 }
 
 void Compiler::advance() {
@@ -44,7 +56,7 @@ void Compiler::consume(TokenType type, const char* message) {
 }
 
 void Compiler::emit_byte(uint8_t byte) {
-    current_chunk()->write_chunk(byte, m_parser->previous().line);
+    current_chunk().write_chunk(byte, m_parser->previous().line);
 }
 
 void Compiler::emit_bytes(uint8_t byte1, uint8_t byte2) {
@@ -52,9 +64,15 @@ void Compiler::emit_bytes(uint8_t byte1, uint8_t byte2) {
     emit_byte(byte2);
 }
 
+void Compiler::emit_short(uint8_t instruction, uint16_t operand) {
+    emit_byte(instruction);
+    emit_byte((operand >> 8) & 0xff);
+    emit_byte(operand & 0xff);
+}
+
 void Compiler::emit_loop(int loop_start) {
     emit_byte(OP_LOOP);
-    int offset = current_chunk()->size() - loop_start + 2;
+    int offset = current_chunk().size() - loop_start + 2;
     if (offset > UINT16_MAX) {
         m_parser->error("Loop body too large.");
         return;
@@ -63,17 +81,17 @@ void Compiler::emit_loop(int loop_start) {
     emit_byte(offset & 0xff);
 }
 
-std::shared_ptr<Chunk> Compiler::current_chunk() {
-    return m_compiling_chunk;
-}
-
 void Compiler::end_compiler() {
     emit_return();
-#ifdef DEBUG_PRINT_CODE
     if (!m_parser->had_error()) {
-        std::cerr << disassemble_chunk(*current_chunk(), "code").str();
+        if (m_optimization_level > 0) {
+            optimize_chunk(current_chunk(), m_unit_start, m_constant_start);
+        }
+        fuse_superinstructions(current_chunk(), m_unit_start);
+    }
+    if (m_print_code && !m_parser->had_error()) {
+        std::cerr << disassemble_chunk(current_chunk(), "code", m_unit_start).str();
     }
-#endif
 }
 
 void Compiler::emit_return() {
@@ -81,26 +99,34 @@ void Compiler::emit_return() {
 }
 
 void Compiler::emit_constant(Value &value) {
-    emit_bytes(OP_CONSTANT, make_constant(value));
+    int constant = make_constant(value);
+    if (constant <= UINT8_MAX) {
+        emit_bytes(OP_CONSTANT, constant);
+    } else {
+        emit_byte(OP_CONSTANT_LONG);
+        emit_byte((constant >> 16) & 0xff);
+        emit_byte((constant >> 8) & 0xff);
+        emit_byte(constant & 0xff);
+    }
 }
 
 int Compiler::emit_jump(uint8_t instruction) {
     emit_byte(instruction);
     emit_byte(0xff);
     emit_byte(0xff);
-    return current_chunk()->size() - 2;
+    return current_chunk().size() - 2;
 }
 
 void Compiler::patch_jump(int offset) {
-    int jump = current_chunk()->size() - offset - 2;
+    int jump = current_chunk().size() - offset - 2;
 
     if (jump > UINT16_MAX) {
         m_parser->error("Too much code to jump over.");
         return;
     }
 
-    (*current_chunk())[offset] = static_cast<uint8_t>((jump >> 8) & 0xff);
-    (*current_chunk())[offset + 1] = static_cast<uint8_t>(jump & 0xff);
+    current_chunk()[offset] = static_cast<uint8_t>((jump >> 8) & 0xff);
+    current_chunk()[offset + 1] = static_cast<uint8_t>(jump & 0xff);
 }
 
 void Compiler::expression() {
@@ -108,7 +134,17 @@ void Compiler::expression() {
 }
 
 void Compiler::number(bool can_assign) {
-    auto value = NUMBER_VAL(strtod(m_parser->previous().start, nullptr));
+    // from_chars reads exactly the token, so the source needs no terminator.
+    const Token &token = m_parser->previous();
+    double number = 0;
+    auto [end, error] = std::from_chars(token.start, token.start + token.length, number);
+    if (error == std::errc::result_out_of_range) {
+        // Too many digits for a double: strtod rounds to infinity or zero
+        // where from_chars gives up.
+        std::string text {token.start, static_cast<size_t>(token.length)};
+        number = strtod(text.c_str(), nullptr);
+    }
+    auto value = NUMBER_VAL(number);
     emit_constant(value);
 }
 
@@ -133,16 +169,16 @@ void Compiler::unary(bool can_assign) {
 
 void Compiler::binary(bool can_assign) {
     TokenType operator_type = m_parser->previous().type;
-    ParseRule& rule {m_parser->get_rule(operator_type)};
+    const ParseRule &rule {Parser::get_rule(operator_type)};
     m_parser->parse_precedence(static_cast<Precedence>(rule.precedence + 1));
 
     switch (operator_type) {
-        case TOKEN_BANG_EQUAL:    emit_bytes(OP_EQUAL, OP_NOT); break;
+        case TOKEN_BANG_EQUAL:    emit_byte(OP_NOT_EQUAL); break;
         case TOKEN_EQUAL_EQUAL:   emit_byte(OP_EQUAL); break;
         case TOKEN_GREATER:       emit_byte(OP_GREATER); break;
-        case TOKEN_GREATER_EQUAL: emit_bytes(OP_LESS, OP_NOT); break;
+        case TOKEN_GREATER_EQUAL: emit_byte(OP_GREATER_EQUAL); break;
         case TOKEN_LESS:          emit_byte(OP_LESS); break;
-        case TOKEN_LESS_EQUAL:    emit_bytes(OP_GREATER, OP_NOT); break;
+        case TOKEN_LESS_EQUAL:    emit_byte(OP_LESS_EQUAL); break;
         case TOKEN_PLUS:          emit_byte(OP_ADD); break;
         case TOKEN_MINUS:         emit_byte(OP_SUBTRACT); break;
         case TOKEN_STAR:          emit_byte(OP_MULTIPLY); break;
@@ -205,14 +241,14 @@ void Compiler::declaration() {
 }
 
 void Compiler::var_declaration() {
-    uint8_t global_index = parse_variable("Expect variable name.");
+    uint16_t global_slot = parse_variable("Expect variable name.");
     if (match(TOKEN_EQUAL)) {
         expression();
     } else {
         emit_byte(OP_NIL);
     }
     consume(TOKEN_SEMICOLON, "Expect ';' after variable declaration.");
-    define_variable(global_index);
+    define_variable(global_slot);
 }
 
 void Compiler::statement() {
@@ -247,19 +283,17 @@ void Compiler::print_statement() {
 
 void Compiler::while_statement() {
     // Compile the condition.
-    int loop_start = current_chunk()->size();
+    int loop_start = current_chunk().size();
     consume(TOKEN_LEFT_PAREN, "Expect '(' after 'while'.");
     expression();
     consume(TOKEN_RIGHT_PAREN, "Expect ')' after condition.");
 
     // Jump to the end of the loop if the condition is false.
-    int exit_jump = emit_jump(OP_JUMP_IF_FALSE);
-    emit_byte(OP_POP);
+    int exit_jump = emit_jump(OP_POP_JUMP_IF_FALSE);
     statement();
     emit_loop(loop_start);
 
     patch_jump(exit_jump);
-    emit_byte(OP_POP);
 }
 
 void Compiler::for_statement() {
@@ -275,22 +309,21 @@ void Compiler::for_statement() {
         expression_statement();
     }
 
-    int loop_start = current_chunk()->size();
+    int loop_start = current_chunk().size();
     int exit_jump = -1;
     if (!match(TOKEN_SEMICOLON)) {
         // Compile the condition.
         expression();
         consume(TOKEN_SEMICOLON, "Expect ';' after loop condition.");
 
-        exit_jump = emit_jump(OP_JUMP_IF_FALSE);
-        emit_byte(OP_POP);
+        exit_jump = emit_jump(OP_POP_JUMP_IF_FALSE);
     }
 
     // Compile the incrementor.
     if (!match(TOKEN_RIGHT_PAREN)) {
         int body_jump = emit_jump(OP_JUMP);
 
-        int increment_start = current_chunk()->size();
+        int increment_start = current_chunk().size();
         expression();
         emit_byte(OP_POP);
         consume(TOKEN_RIGHT_PAREN, "Expect ')' after for clauses.");
@@ -305,7 +338,6 @@ void Compiler::for_statement() {
 
     if (exit_jump != -1) {
         patch_jump(exit_jump);
-        emit_byte(OP_POP);
     }
 
     end_scope();
@@ -316,14 +348,12 @@ void Compiler::if_statement() {
     expression();
     consume(TOKEN_RIGHT_PAREN, "Expect ')' after condition.");
 
-    int then_jump = emit_jump(OP_JUMP_IF_FALSE);
-    emit_byte(OP_POP);
+    int then_jump = emit_jump(OP_POP_JUMP_IF_FALSE);
     statement();
 
     int else_jump = emit_jump(OP_JUMP);
 
     patch_jump(then_jump);
-    emit_byte(OP_POP);
 
     if (match(TOKEN_ELSE)) {
         statement();
@@ -367,13 +397,13 @@ bool Compiler::match(TokenType type) {
     return false;
 }
 
-uint8_t Compiler::parse_variable(const char* error_message) {
+uint16_t Compiler::parse_variable(const char* error_message) {
     consume(TOKEN_IDENTIFIER, error_message);
 
     declare_variable();
     if (m_scope_depth > 0) return 0;
 
-    return identifier_constant(m_parser->previous());
+    return resolve_global(m_parser->previous());
 }
 
 void Compiler::declare_variable() {
@@ -393,48 +423,54 @@ void Compiler::declare_variable() {
     add_local(name);
 }
 
-void Compiler::define_variable(uint8_t global_index) {
+void Compiler::define_variable(uint16_t global_slot) {
     if (m_scope_depth > 0) {
         // Mark initialized
         m_locals.back().depth = m_scope_depth;
         return;
     }
 
-    emit_bytes(OP_DEFINE_GLOBAL, global_index);
+    emit_short(OP_DEFINE_GLOBAL, global_slot);
 }
 
-uint8_t Compiler::identifier_constant(Token& token) {
-    Value value = OBJ_VAL(ObjString::copy_string(token.start, token.length));
-    return make_constant(value);
+uint16_t Compiler::resolve_global(Token &name) {
+    int slot = vm.global_slot(ObjString::copy_string(name.start, name.length));
+    if (slot > UINT16_MAX) {
+        m_parser->error("Too many global variables.");
+        return 0;
+    }
+
+    return (uint16_t) slot;
 }
 
-uint8_t Compiler::make_constant(Value &value) {
-    int constant = current_chunk()->add_constant(value);
-    if (constant > UINT8_MAX) {
+int Compiler::make_constant(Value &value) {
+    int constant = current_chunk().add_constant(value);
+    if (constant > MAX_CONSTANTS) {
         m_parser->error("Too many constants in one chunk");
         return 0;
     }
 
-    return (uint8_t) constant;
+    return constant;
 }
 
 void Compiler::named_variable(Token &name, bool can_assign) {
-    uint8_t get_op {}, set_op {};
     int arg = resolve_local(name);
     if (arg != -1) {
-        get_op = OP_GET_LOCAL;
-        set_op = OP_SET_LOCAL;
-    } else {
-        arg = identifier_constant(name);
-        get_op = OP_GET_GLOBAL;
-        set_op = OP_SET_GLOBAL;
+        if (can_assign && match(TOKEN_EQUAL)) {
+            expression();
+            emit_bytes(OP_SET_LOCAL, arg);
+        } else {
+            emit_bytes(OP_GET_LOCAL, arg);
+        }
+        return;
     }
 
+    uint16_t slot = resolve_global(name);
     if (can_assign && match(TOKEN_EQUAL)) {
         expression();
-        emit_bytes(set_op, arg);
+        emit_short(OP_SET_GLOBAL, slot);
     } else {
-        emit_bytes(get_op, arg);
+        emit_short(OP_GET_GLOBAL, slot);
     }
 }
 
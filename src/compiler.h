@@ -1,7 +1,7 @@
 #pragma once
 
 #include <memory>
-#include <functional>
+#include <string_view>
 
 #include "chunk.h"
 #include "parser.h"
@@ -14,20 +14,27 @@ struct Local {
 
 struct Compiler {
     // bool compile(const std::string &source, Chunk &chunk); 
-    Compiler();
-    bool compile(const std::string &source, std::shared_ptr<Chunk> chunk);   
+    // print_code disassembles each compiled unit to stderr.
+    explicit Compiler(int optimization_level = 0, bool print_code = false);
+    // Appends the compiled source to chunk, ending in OP_RETURN. On error the
+    // chunk is left as it was.
+    bool compile(std::string_view source, std::shared_ptr<Chunk> chunk);
     void advance();
     void consume(TokenType type, const char* message);
 
     void emit_byte(uint8_t byte);
     void emit_bytes(uint8_t byte1, uint8_t byte2);
+    void emit_short(uint8_t instruction, uint16_t operand);
     void emit_loop(int loop_start);
     void emit_return();
     void emit_constant(Value &value);
     int emit_jump(uint8_t instruction);
     void patch_jump(int offset);
 
-    std::shared_ptr<Chunk> current_chunk();
+    // A plain reference, so emitting a byte does not touch the refcount.
+    inline Chunk& current_chunk() {
+        return *m_compiling_chunk;
+    }
     void end_compiler();
 
     void expression();
@@ -57,11 +64,11 @@ struct Compiler {
 
     bool match(TokenType type);
 
-    uint8_t parse_variable(const char* error_message);
+    uint16_t parse_variable(const char* error_message);
     void declare_variable();
-    void define_variable(uint8_t global_index);
-    uint8_t identifier_constant(Token& toknen);
-    uint8_t make_constant(Value &value);
+    void define_variable(uint16_t global_slot);
+    uint16_t resolve_global(Token &name);
+    int make_constant(Value &value);
     void named_variable(Token &name, bool can_assign);   
     void add_local(Token &name);
     int resolve_local(Token &name);
@@ -71,6 +78,13 @@ private:
     std::unique_ptr<Parser> m_parser;
     std::shared_ptr<Scanner> m_scanner;
     std::shared_ptr<Chunk> m_compiling_chunk;
+    // Offset in m_compiling_chunk where this compile's code begins; code
+    // before it belongs to earlier compiles and is left alone.
+    int m_unit_start {0};
+    // Size of the constant pool when this compile began.
+    int m_constant_start {0};
+    int m_optimization_level {0};
+    bool m_print_code {false};
 
     // Locals
     std::vector<Local> m_locals {};
@@ -6,14 +6,170 @@
 #include "util.h"
 #include "debug.h"
 #include "chunk.h"
+#include "register_chunk.h"
 #include "value.h"
+#include "vm.h"
+#include "objects/objstring.h"
 
-std::stringstream disassemble_chunk(const Chunk &chunk, const char* name) {
+extern VM vm;
+
+std::stringstream disassemble_chunk(const Chunk &chunk, const char* name, int start) {
     std::stringstream output {};
     output << string_format("== %s ==", name) << std::endl;
 
-    for (int offset = 0; offset < chunk.size();) {
-        offset = disassemble_instruction(chunk, offset, output);
+    // Walk the line runs alongside the code instead of looking up each offset.
+    const std::vector<LineStart> &lines = chunk.lines();
+    size_t run = 0;
+    int previous_line = start > 0 ? chunk.get_line(start - 1) : -1;
+    for (int offset = start; offset < static_cast<int>(chunk.size());) {
+        while (run + 1 < lines.size() && lines[run + 1].offset <= offset) run++;
+        int line = run < lines.size() && lines[run].offset <= offset ? lines[run].line : 0;
+        offset = disassemble_instruction(chunk, offset, line, previous_line, output);
+        previous_line = line;
+        output << std::endl;
+    }
+    output << std::endl;
+    return output;
+}
+
+const char* opcode_name(uint8_t op) {
+    switch (op) {
+        case OP_CONSTANT: return "OP_CONSTANT";
+        case OP_CONSTANT_LONG: return "OP_CONSTANT_LONG";
+        case OP_NIL: return "OP_NIL";
+        case OP_TRUE: return "OP_TRUE";
+        case OP_FALSE: return "OP_FALSE";
+        case OP_POP: return "OP_POP";
+        case OP_GET_LOCAL: return "OP_GET_LOCAL";
+        case OP_SET_LOCAL: return "OP_SET_LOCAL";
+        case OP_GET_GLOBAL: return "OP_GET_GLOBAL";
+        case OP_SET_GLOBAL: return "OP_SET_GLOBAL";
+        case OP_DEFINE_GLOBAL: return "OP_DEFINE_GLOBAL";
+        case OP_EQUAL: return "OP_EQUAL";
+        case OP_NOT_EQUAL: return "OP_NOT_EQUAL";
+        case OP_GREATER: return "OP_GREATER";
+        case OP_GREATER_EQUAL: return "OP_GREATER_EQUAL";
+        case OP_LESS: return "OP_LESS";
+        case OP_LESS_EQUAL: return "OP_LESS_EQUAL";
+        case OP_ADD: return "OP_ADD";
+        case OP_SUBTRACT: return "OP_SUBTRACT";
+        case OP_MULTIPLY: return "OP_MULTIPLY";
+        case OP_DIVIDE: return "OP_DIVIDE";
+        case OP_NOT: return "OP_NOT";
+        case OP_NEGATE: return "OP_NEGATE";
+        case OP_PRINT: return "OP_PRINT";
+        case OP_JUMP: return "OP_JUMP";
+        case OP_JUMP_IF_FALSE: return "OP_JUMP_IF_FALSE";
+        case OP_POP_JUMP_IF_FALSE: return "OP_POP_JUMP_IF_FALSE";
+        case OP_LOOP: return "OP_LOOP";
+        case OP_RETURN: return "OP_RETURN";
+        case OP_ADD_LOCAL_CONSTANT: return "OP_ADD_LOCAL_CONSTANT";
+        case OP_SUBTRACT_LOCAL_CONSTANT: return "OP_SUBTRACT_LOCAL_CONSTANT";
+        case OP_LESS_JUMP_IF_FALSE: return "OP_LESS_JUMP_IF_FALSE";
+        case OP_LESS_EQUAL_JUMP_IF_FALSE: return "OP_LESS_EQUAL_JUMP_IF_FALSE";
+        case OP_GREATER_JUMP_IF_FALSE: return "OP_GREATER_JUMP_IF_FALSE";
+        case OP_GREATER_EQUAL_JUMP_IF_FALSE: return "OP_GREATER_EQUAL_JUMP_IF_FALSE";
+        default: return "Unknown opcode";
+    }
+}
+
+static const char* register_op_name(uint16_t op) {
+    switch (op) {
+        case REG_MOVE: return "REG_MOVE";
+        case REG_GET_GLOBAL: return "REG_GET_GLOBAL";
+        case REG_SET_GLOBAL: return "REG_SET_GLOBAL";
+        case REG_DEFINE_GLOBAL: return "REG_DEFINE_GLOBAL";
+        case REG_EQUAL: return "REG_EQUAL";
+        case REG_NOT_EQUAL: return "REG_NOT_EQUAL";
+        case REG_GREATER: return "REG_GREATER";
+        case REG_GREATER_EQUAL: return "REG_GREATER_EQUAL";
+        case REG_LESS: return "REG_LESS";
+        case REG_LESS_EQUAL: return "REG_LESS_EQUAL";
+        case REG_ADD: return "REG_ADD";
+        case REG_SUBTRACT: return "REG_SUBTRACT";
+        case REG_MULTIPLY: return "REG_MULTIPLY";
+        case REG_DIVIDE: return "REG_DIVIDE";
+        case REG_NOT: return "REG_NOT";
+        case REG_NEGATE: return "REG_NEGATE";
+        case REG_PRINT: return "REG_PRINT";
+        case REG_JUMP: return "REG_JUMP";
+        case REG_JUMP_IF_FALSE: return "REG_JUMP_IF_FALSE";
+        case REG_LESS_JUMP_IF_FALSE: return "REG_LESS_JUMP_IF_FALSE";
+        case REG_LESS_EQUAL_JUMP_IF_FALSE: return "REG_LESS_EQUAL_JUMP_IF_FALSE";
+        case REG_GREATER_JUMP_IF_FALSE: return "REG_GREATER_JUMP_IF_FALSE";
+        case REG_GREATER_EQUAL_JUMP_IF_FALSE: return "REG_GREATER_EQUAL_JUMP_IF_FALSE";
+        case REG_RETURN: return "REG_RETURN";
+        default: return "Unknown opcode";
+    }
+}
+
+// Registers print as r<n>, constants as their value.
+static void register_operand(const Chunk &constants, uint16_t operand, std::stringstream &output) {
+    if (operand < REGISTER_CONSTANT_BASE) {
+        output << " r" << operand;
+    } else {
+        output << " ";
+        print_value(constants.constants()[operand - REGISTER_CONSTANT_BASE], output);
+    }
+}
+
+std::stringstream disassemble_register_chunk(const RegisterChunk &chunk, const Chunk &constants, const char* name) {
+    std::stringstream output {};
+    output << string_format("== %s ==", name) << std::endl;
+
+    int previous_line = -1;
+    for (int index = 0; index < static_cast<int>(chunk.m_code.size()); index++) {
+        const RegisterInstruction &instruction = chunk.m_code[index];
+        output << std::setfill('0') << std::setw(4) << index << " ";
+        int line = chunk.get_line(index);
+        if (line == previous_line)
+            output << "   | ";
+        else
+            output << std::setfill('0') << std::setw(4) << line << " ";
+        previous_line = line;
+        output << std::left << std::setw(16) << std::setfill(' ') << register_op_name(instruction.op) << std::right;
+
+        switch (instruction.op) {
+            case REG_GET_GLOBAL:
+                output << " r" << instruction.a << " " << vm.m_global_names[instruction.b]->view();
+                break;
+            case REG_SET_GLOBAL:
+            case REG_DEFINE_GLOBAL:
+                output << " " << vm.m_global_names[instruction.a]->view();
+                register_operand(constants, instruction.b, output);
+                break;
+            case REG_PRINT:
+                register_operand(constants, instruction.a, output);
+                break;
+            case REG_JUMP:
+                output << " -> " << instruction.a;
+                break;
+            case REG_JUMP_IF_FALSE:
+                register_operand(constants, instruction.b, output);
+                output << " -> " << instruction.a;
+                break;
+            case REG_LESS_JUMP_IF_FALSE:
+            case REG_LESS_EQUAL_JUMP_IF_FALSE:
+            case REG_GREATER_JUMP_IF_FALSE:
+            case REG_GREATER_EQUAL_JUMP_IF_FALSE:
+                register_operand(constants, instruction.b, output);
+                register_operand(constants, instruction.c, output);
+                output << " -> " << instruction.a;
+                break;
+            case REG_RETURN:
+                break;
+            case REG_MOVE:
+            case REG_NOT:
+            case REG_NEGATE:
+                output << " r" << instruction.a;
+                register_operand(constants, instruction.b, output);
+                break;
+            default:
+                output << " r" << instruction.a;
+                register_operand(constants, instruction.b, output);
+                register_operand(constants, instruction.c, output);
+                break;
+        }
         output << std::endl;
     }
     output << std::endl;
@@ -22,16 +178,24 @@ std::stringstream disassemble_chunk(const Chunk &chunk, const char* name) {
 
 template <typename stream_type>
 int disassemble_instruction(const Chunk &chunk, int offset, stream_type &output) {
+    int previous_line = offset > 0 ? chunk.get_line(offset - 1) : -1;
+    return disassemble_instruction(chunk, offset, chunk.get_line(offset), previous_line, output);
+}
+
+template <typename stream_type>
+int disassemble_instruction(const Chunk &chunk, int offset, int line, int previous_line, stream_type &output) {
     output << std::setfill('0') << std::setw(4) << offset << " ";
-    if (offset > 0 && chunk.get_line(offset) == chunk.get_line(offset-1))
+    if (line == previous_line)
         output << "   | ";
     else
-        output << std::setfill('0') << std::setw(4) << chunk.get_line(offset) << " ";
+        output << std::setfill('0') << std::setw(4) << line << " ";
 
     uint8_t instruction = chunk[offset];
     switch (instruction) {
         case OP_CONSTANT:
             return constant_instruction("OP_CONSTANT", chunk, offset, output);
+        case OP_CONSTANT_LONG:
+            return constant_long_instruction("OP_CONSTANT_LONG", chunk, offset, output);
         case OP_NIL:
             return simple_instruction("OP_NIL", offset, output);
         case OP_TRUE:
@@ -45,17 +209,23 @@ int disassemble_instruction(const Chunk &chunk, int offset, stream_type &output)
         case OP_SET_LOCAL:
             return byte_instruction("OP_SET_LOCAL", chunk, offset, output);
         case OP_GET_GLOBAL:
-            return constant_instruction("OP_GET_GLOBAL", chunk, offset, output);
+            return global_instruction("OP_GET_GLOBAL", chunk, offset, output);
         case OP_DEFINE_GLOBAL:
-            return constant_instruction("OP_DEFINE_GLOBAL", chunk, offset, output);
+            return global_instruction("OP_DEFINE_GLOBAL", chunk, offset, output);
         case OP_SET_GLOBAL:
-            return constant_instruction("OP_SET_GLOBAL", chunk, offset, output);
+            return global_instruction("OP_SET_GLOBAL", chunk, offset, output);
         case OP_EQUAL:
             return simple_instruction("OP_EQUAL", offset, output);
+        case OP_NOT_EQUAL:
+            return simple_instruction("OP_NOT_EQUAL", offset, output);
         case OP_GREATER:
             return simple_instruction("OP_GREATER", offset, output);
+        case OP_GREATER_EQUAL:
+            return simple_instruction("OP_GREATER_EQUAL", offset, output);
         case OP_LESS:
             return simple_instruction("OP_LESS", offset, output);
+        case OP_LESS_EQUAL:
+            return simple_instruction("OP_LESS_EQUAL", offset, output);
         case OP_ADD:
             return simple_instruction("OP_ADD", offset, output);
         case OP_SUBTRACT:
@@ -72,12 +242,26 @@ int disassemble_instruction(const Chunk &chunk, int offset, stream_type &output)
             return jump_instruction("OP_JUMP", 1, chunk, offset, output);
         case OP_JUMP_IF_FALSE:
             return jump_instruction("OP_JUMP_IF_FALSE", 1, chunk, offset, output);
+        case OP_POP_JUMP_IF_FALSE:
+            return jump_instruction("OP_POP_JUMP_IF_FALSE", 1, chunk, offset, output);
         case OP_LOOP:
             return jump_instruction("OP_LOOP", -1, chunk, offset, output);
         case OP_RETURN:
             return simple_instruction("OP_RETURN", offset, output);
         case OP_NOT:
             return simple_instruction("OP_NOT", offset, output);
+        case OP_ADD_LOCAL_CONSTANT:
+            return local_constant_instruction("OP_ADD_LOCAL_CONSTANT", chunk, offset, output);
+        case OP_SUBTRACT_LOCAL_CONSTANT:
+            return local_constant_instruction("OP_SUBTRACT_LOCAL_CONSTANT", chunk, offset, output);
+        case OP_LESS_JUMP_IF_FALSE:
+            return jump_instruction("OP_LESS_JUMP_IF_FALSE", 1, chunk, offset, output);
+        case OP_LESS_EQUAL_JUMP_IF_FALSE:
+            return jump_instruction("OP_LESS_EQUAL_JUMP_IF_FALSE", 1, chunk, offset, output);
+        case OP_GREATER_JUMP_IF_FALSE:
+            return jump_instruction("OP_GREATER_JUMP_IF_FALSE", 1, chunk, offset, output);
+        case OP_GREATER_EQUAL_JUMP_IF_FALSE:
+            return jump_instruction("OP_GREATER_EQUAL_JUMP_IF_FALSE", 1, chunk, offset, output);
         default:
             output << "Unknown opcode " << instruction;
             return offset += 1;
@@ -99,6 +283,15 @@ int constant_instruction(std::string name, const Chunk &chunk, int offset, strea
     return offset + 2;
 }
 
+template <typename stream_type>
+int constant_long_instruction(std::string name, const Chunk &chunk, int offset, stream_type &output) {
+    uint32_t constant = (chunk[offset + 1] << 16) | (chunk[offset + 2] << 8) | chunk[offset + 3];
+    output << std::left << std::setw(16) << std::setfill(' ') << name << " " << std::right;
+    output << std::setw(4) << std::setfill('0') << constant << " ";
+    print_value(chunk.constants()[constant], output);
+    return offset + 4;
+}
+
 template <typename stream_type>
 int byte_instruction(std::string name, const Chunk &chunk, int offset, stream_type &output) {
     uint8_t slot = chunk[offset + 1];
@@ -107,6 +300,27 @@ int byte_instruction(std::string name, const Chunk &chunk, int offset, stream_ty
     return offset + 2;
 }
 
+template <typename stream_type>
+int local_constant_instruction(std::string name, const Chunk &chunk, int offset, stream_type &output) {
+    uint8_t slot = chunk[offset + 1];
+    uint8_t constant = chunk[offset + 2];
+    output << std::left << std::setw(16) << std::setfill(' ') << name << " " << std::right;
+    output << std::setw(4) << std::setfill('0') << (unsigned int)slot << " ";
+    output << std::setw(4) << std::setfill('0') << (unsigned int)constant << " ";
+    print_value(chunk.constants()[constant], output);
+    return offset + 3;
+}
+
+template <typename stream_type>
+int global_instruction(std::string name, const Chunk &chunk, int offset, stream_type &output) {
+    uint16_t slot = chunk[offset + 1] << 8;
+    slot |= chunk[offset + 2];
+    output << std::left << std::setw(16) << std::setfill(' ') << name << " " << std::right;
+    output << std::setw(4) << std::setfill('0') << (unsigned int)slot << " ";
+    output << vm.m_global_names[slot]->view();
+    return offset + 3;
+}
+
 template <typename stream_type>
 int jump_instruction(std::string name, int sign, const Chunk &chunk, int offset, stream_type &output) {
     uint16_t jump = chunk[offset + 1] << 8;
@@ -118,13 +332,21 @@ int jump_instruction(std::string name, int sign, const Chunk &chunk, int offset,
 }
 
 template int disassemble_instruction(const Chunk&, int, std::stringstream&);
+template int disassemble_instruction(const Chunk&, int, int, int, std::stringstream&);
 template int simple_instruction(std::string, int, std::stringstream&);
 template int constant_instruction(std::string, const Chunk &, int, std::stringstream&);
+template int constant_long_instruction(std::string, const Chunk &, int, std::stringstream&);
 template int byte_instruction(std::string, const Chunk &, int, std::stringstream&);
+template int local_constant_instruction(std::string, const Chunk &, int, std::stringstream&);
+template int global_instruction(std::string, const Chunk &, int, std::stringstream&);
 template int jump_instruction(std::string, int, const Chunk &, int, std::stringstream&);
 
 template int disassemble_instruction(const Chunk&, int, std::ostream&);
+template int disassemble_instruction(const Chunk&, int, int, int, std::ostream&);
 template int simple_instruction(std::string, int, std::ostream&);
 template int constant_instruction(std::string, const Chunk &, int, std::ostream&);
+template int constant_long_instruction(std::string, const Chunk &, int, std::ostream&);
 template int byte_instruction(std::string, const Chunk &, int, std::ostream&);
+template int local_constant_instruction(std::string, const Chunk &, int, std::ostream&);
+template int global_instruction(std::string, const Chunk &, int, std::ostream&);
 template int jump_instruction(std::string, int, const Chunk &, int, std::ostream&);
\ No newline at end of file
@@ -1,20 +1,37 @@
 #pragma once
 
 struct Chunk;
+struct RegisterChunk;
 
-std::stringstream disassemble_chunk(const Chunk &chunk, const char* name);
+std::stringstream disassemble_chunk(const Chunk &chunk, const char* name, int start = 0);
+std::stringstream disassemble_register_chunk(const RegisterChunk &chunk, const Chunk &constants, const char* name);
+const char* opcode_name(uint8_t op);
 
 template <typename stream_type>
 int disassemble_instruction(const Chunk &chunk, int offset, stream_type &output);
 
+// As above, for callers walking the code in order that already know the
+// instruction's line and the one before it. A repeated line prints as "|".
+template <typename stream_type>
+int disassemble_instruction(const Chunk &chunk, int offset, int line, int previous_line, stream_type &output);
+
 template <typename stream_type>
 int simple_instruction(std::string name, int offset, stream_type &output);
 
 template <typename stream_type>
 int constant_instruction(std::string name, const Chunk &chunk, int offset, stream_type &output);
 
+template <typename stream_type>
+int constant_long_instruction(std::string name, const Chunk &chunk, int offset, stream_type &output);
+
 template <typename stream_type>
 int byte_instruction(std::string name, const Chunk &chunk, int offset, stream_type &output);
 
+template <typename stream_type>
+int local_constant_instruction(std::string name, const Chunk &chunk, int offset, stream_type &output);
+
+template <typename stream_type>
+int global_instruction(std::string name, const Chunk &chunk, int offset, stream_type &output);
+
 template <typename stream_type>
 int jump_instruction(std::string name, int sign, const Chunk &chunk, int offset, stream_type &output);
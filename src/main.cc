@@ -2,35 +2,81 @@
 #include <stdlib.h>
 #include <string.h>
 
-#include <iostream>
 #include <fstream>
+#include <iostream>
 
 #include "common.h"
 #include "chunk.h"
 #include "debug.h"
+#include "mapped_file.h"
+#include "sampler.h"
 #include "vm.h"
 
 VM vm;
 
-static void run_file(const char* path, VM &vm) {
-    std::ifstream in {path};
-    if (!in.is_open()) {
+// Maps the script at path; the scanner reads it straight out of the mapping.
+static void map_file(const char* path, MappedFile &file) {
+    if (!file.open(path)) {
         std::cerr << "Could not open file " << path << "." << std::endl;
         exit(74);
     }
+}
+
+static bool is_bytecode_path(const std::string &path) {
+    return path.ends_with(".loxc");
+}
 
-    std::stringstream buffer;
-    buffer << in.rdbuf();
-    in.close();
+static void run_bytecode(const char* path, VM &vm) {
+    MappedBytecode bytecode {};
+    std::string error {};
+    if (!bytecode.open(path, error)) {
+        std::cerr << error << std::endl;
+        exit(74);
+    }
 
-    std::string source {buffer.str()};
-    InterpretResult result = vm.interpret(source);
+    InterpretResult result = vm.interpret(bytecode);
 
     if (result == INTERPRET_COMPILE_ERROR) exit(65);
     if (result == INTERPRET_RUNTIME_ERROR) exit(70);
 }
 
+static void run_file(const char* path, VM &vm) {
+    if (is_bytecode_path(path)) {
+        run_bytecode(path, vm);
+        return;
+    }
+
+    MappedFile source {};
+    map_file(path, source);
+    InterpretResult result = vm.interpret(source.view());
+
+    if (result == INTERPRET_COMPILE_ERROR) exit(65);
+    if (result == INTERPRET_RUNTIME_ERROR) exit(70);
+}
+
+// Compiles the script at path to path with its extension replaced by .loxc.
+static void compile_file(const char* path, VM &vm) {
+    MappedFile source {};
+    map_file(path, source);
+    std::shared_ptr<Chunk> chunk = vm.compile(source.view());
+    if (chunk == nullptr) exit(65);
+
+    std::string output {path};
+    size_t extension = output.find_last_of('.');
+    if (extension != std::string::npos && output.find('/', extension) == std::string::npos) {
+        output.erase(extension);
+    }
+    output += ".loxc";
+
+    std::string error {};
+    if (!write_bytecode(*chunk, vm.m_global_names, output.c_str(), error)) {
+        std::cerr << error << std::endl;
+        exit(74);
+    }
+}
+
 static void repl(VM &vm) {
+    vm.m_incremental = true;
     std::cout << "> ";
     for (std::string line; std::getline(std::cin, line);) {
         vm.interpret(line);
@@ -39,14 +85,93 @@ static void repl(VM &vm) {
     std::cout << std::endl;
 }
 
+static Sampler sampler {};
+static std::string sample_output {};
+static std::string sample_script {"repl"};
+
+// Every run has drained its samples already; what is left was taken outside
+// the interpreter loops.
+static void write_line_profile() {
+    sampler.stop();
+    sampler.drain(nullptr, nullptr);
+
+    std::ofstream out {sample_output};
+    sampler.write_collapsed(out, sample_script);
+    if (!out) {
+        std::cerr << "Could not write file " << sample_output << "." << std::endl;
+    }
+    if (sampler.dropped() > 0) {
+        std::cerr << sampler.dropped() << " samples dropped." << std::endl;
+    }
+}
+
+#ifdef PROFILE_OPS
+static void print_op_profile() {
+    vm.m_op_profile.print(std::cerr);
+}
+#endif
+
+static void usage() {
+    std::cerr << "Usage: clox [-O0|-O1] [--backend=stack|register] [--compile] [--trace] [--print-code]\n"
+                 "            [--profile-ops] [--profile-lines=FILE [--sample-hz=N]] [path]\n";
+    exit(64);
+}
+
 int main(int argc, const char* argv[]) {
-    if (argc == 1) {
+    const char* path = nullptr;
+    bool compile_only = false;
+    int sample_hz = SAMPLER_DEFAULT_HZ;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-O0") == 0) {
+            vm.m_optimization_level = 0;
+        } else if (strcmp(argv[i], "-O1") == 0 || strcmp(argv[i], "-O") == 0) {
+            vm.m_optimization_level = 1;
+        } else if (strcmp(argv[i], "--backend=stack") == 0) {
+            vm.m_backend = BACKEND_STACK;
+        } else if (strcmp(argv[i], "--backend=register") == 0) {
+            vm.m_backend = BACKEND_REGISTER;
+        } else if (strcmp(argv[i], "--compile") == 0) {
+            compile_only = true;
+        } else if (strcmp(argv[i], "--trace") == 0) {
+            vm.m_trace = true;
+        } else if (strcmp(argv[i], "--print-code") == 0) {
+            vm.m_print_code = true;
+        } else if (strcmp(argv[i], "--profile-ops") == 0) {
+#ifdef PROFILE_OPS
+            // Runs on every way out, including the exit()s on errors.
+            atexit(print_op_profile);
+#else
+            std::cerr << "--profile-ops needs a build with CPPLOX_PROFILE_OPS=ON.\n";
+            exit(64);
+#endif
+        } else if (strncmp(argv[i], "--profile-lines=", 16) == 0 && argv[i][16] != '\0') {
+            sample_output = argv[i] + 16;
+        } else if (strncmp(argv[i], "--sample-hz=", 12) == 0) {
+            sample_hz = atoi(argv[i] + 12);
+        } else if (argv[i][0] != '-' && path == nullptr) {
+            path = argv[i];
+        } else {
+            usage();
+        }
+    }
+
+    if (!sample_output.empty()) {
+        if (path != nullptr) sample_script = path;
+        if (!sampler.start(sample_hz)) {
+            std::cerr << "Could not start the sampling profiler." << std::endl;
+            exit(64);
+        }
+        vm.m_sampler = &sampler;
+        atexit(write_line_profile);
+    }
+
+    if (compile_only) {
+        if (path == nullptr) usage();
+        compile_file(path, vm);
+    } else if (path == nullptr) {
         repl(vm);
-    } else if (argc == 2) {
-        run_file(argv[1], vm);
     } else {
-        std::cerr << "Usage: clox [path]\n";
-        exit(64);
+        run_file(path, vm);
     }
 
     return 0;
@@ -0,0 +1,58 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "mapped_file.h"
+
+MappedFile::~MappedFile() {
+    if (m_mapped) {
+        munmap(const_cast<uint8_t*>(m_data), m_size);
+    }
+}
+
+bool MappedFile::open(const char* path) {
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0) return false;
+
+    struct stat status;
+    if (fstat(fd, &status) < 0) {
+        close(fd);
+        return false;
+    }
+
+    if (!S_ISREG(status.st_mode)) {
+        bool ok = read_all(fd);
+        close(fd);
+        return ok;
+    }
+
+    size_t size = status.st_size;
+    if (size > 0) {
+        void* data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {
+            close(fd);
+            return false;
+        }
+        // Sources and bytecode are read front to back once.
+        madvise(data, size, MADV_SEQUENTIAL);
+        m_data = static_cast<const uint8_t*>(data);
+        m_mapped = true;
+    }
+    m_size = size;
+    close(fd);
+    return true;
+}
+
+bool MappedFile::read_all(int fd) {
+    char buffer[4096];
+    for (;;) {
+        ssize_t count = read(fd, buffer, sizeof(buffer));
+        if (count < 0) return false;
+        if (count == 0) break;
+        m_buffer.append(buffer, count);
+    }
+    m_data = reinterpret_cast<const uint8_t*>(m_buffer.data());
+    m_size = m_buffer.size();
+    return true;
+}
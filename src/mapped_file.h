@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+// A whole file mapped read-only into memory. Empty files have no mapping and
+// view as an empty string. Pipes and other files that cannot be mapped are
+// read into a buffer instead.
+struct MappedFile {
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile();
+
+    bool open(const char* path);
+
+    inline const uint8_t* data() const {
+        return m_data;
+    }
+    inline size_t size() const {
+        return m_size;
+    }
+    // The contents are not null-terminated.
+    inline std::string_view view() const {
+        return std::string_view {reinterpret_cast<const char*>(m_data), m_size};
+    }
+
+private:
+    const uint8_t* m_data {nullptr};
+    size_t m_size {0};
+    bool m_mapped {false};
+    std::string m_buffer {};
+
+    bool read_all(int fd);
+};
@@ -1,4 +1,12 @@
+#include <algorithm>
+
 #include "memory.h"
+#include "vm.h"
+#include "objects/object.h"
+#include "objects/objrope.h"
+#include "objects/objstring.h"
+
+extern VM vm;
 
 void* reallocate(void* pointer, size_t oldSize, size_t newSize) {
   	if (newSize == 0) {
@@ -10,4 +18,83 @@ void* reallocate(void* pointer, size_t oldSize, size_t newSize) {
 	if (result == NULL) exit(1);
 
 	return result;
+}
+
+void track_allocation(size_t size) {
+	vm.m_bytes_allocated += size;
+#ifdef DEBUG_STRESS_GC
+	collect_garbage();
+#else
+	if (vm.m_bytes_allocated > vm.m_next_gc) {
+		collect_garbage();
+	}
+#endif
+}
+
+void mark_object(Obj* object) {
+	if (object == nullptr || object->m_is_marked) return;
+
+	object->m_is_marked = true;
+	vm.m_gray_stack.push_back(object);
+}
+
+void mark_value(const Value &value) {
+	if (IS_OBJ(value)) mark_object(AS_OBJ(value));
+}
+
+static void blacken_object(Obj* object) {
+	switch (object->m_type) {
+		// Strings hold no references.
+		case OBJ_STRING:
+			break;
+		case OBJ_ROPE: {
+			ObjRope* rope = static_cast<ObjRope*>(object);
+			mark_object(rope->m_left);
+			mark_object(rope->m_right);
+			mark_object(rope->m_flat);
+			break;
+		}
+	}
+}
+
+static void trace_references() {
+	while (!vm.m_gray_stack.empty()) {
+		Obj* object = vm.m_gray_stack.back();
+		vm.m_gray_stack.pop_back();
+		blacken_object(object);
+	}
+}
+
+static void sweep() {
+	Obj* previous = nullptr;
+	Obj* object = vm.m_objects;
+	while (object != nullptr) {
+		if (object->m_is_marked) {
+			object->m_is_marked = false;
+			previous = object;
+			object = object->m_next;
+			continue;
+		}
+
+		Obj* unreached = object;
+		object = object->m_next;
+		if (previous != nullptr) {
+			previous->m_next = object;
+		} else {
+			vm.m_objects = object;
+		}
+
+		vm.m_bytes_allocated -= unreached->allocated_size();
+		Obj::free_object(unreached);
+	}
+}
+
+void collect_garbage() {
+	vm.mark_roots();
+	trace_references();
+	// The intern table holds its strings weakly.
+	vm.m_strings.remove_white();
+	sweep();
+
+	vm.m_next_gc = std::max<size_t>(vm.m_bytes_allocated * vm.m_gc_grow_factor, GC_INITIAL_HEAP);
 }
\ No newline at end of file
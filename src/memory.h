@@ -10,3 +10,20 @@
         sizeof(type) * (newCount))
 
 void* reallocate(void* pointer, size_t oldSize, size_t newSize);
+
+#ifndef GC_HEAP_GROW_FACTOR
+#define GC_HEAP_GROW_FACTOR 2
+#endif
+
+#define GC_INITIAL_HEAP (1024 * 1024)
+
+struct Obj;
+struct Value;
+
+// Accounts for a new heap object of the given size. Runs a collection first
+// when the heap has outgrown its threshold, or always under DEBUG_STRESS_GC.
+void track_allocation(size_t size);
+
+void collect_garbage();
+void mark_object(Obj* object);
+void mark_value(const Value &value);
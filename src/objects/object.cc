@@ -2,20 +2,14 @@
 #include <string.h>
 
 #include "object.h"
+#include "objrope.h"
 #include "objstring.h"
 #include "../value.h"
 #include "../vm.h"
 
 extern VM vm;
 
-Obj::Obj() {
-    // std::cout << "OBJ CONSTRUCTOR" << std::endl;
-    allocate_object();
-}
-
-Obj::~Obj() {
-    // std::cout << "OBJ DESTRUCTOR" << std::endl;
-}
+Obj::Obj(ObjType type): m_type {type} {}
 
 void Obj::allocate_object() {
     // std::cout << "CALLING ALLOCATE OBJECT" << std::endl;
@@ -23,14 +17,25 @@ void Obj::allocate_object() {
     vm.m_objects = this;
 }
 
-Obj* Obj::clone() {
-    // std::cout << "OBJ CLONE" << std::endl;
-    return new Obj {*this};
+size_t Obj::allocated_size() const {
+    switch (m_type) {
+        case OBJ_STRING:
+            return sizeof(ObjString) + static_cast<const ObjString*>(this)->m_length + 1;
+        case OBJ_ROPE:
+            return sizeof(ObjRope);
+    }
+    return 0; // Unreachable.
 }
 
-Obj* Obj::copy() {
-    // std::cout << "OBJ COPY" << std::endl;
-    return new Obj {*this};
+void Obj::free_object(Obj* object) {
+    switch (object->m_type) {
+        case OBJ_STRING:
+            ObjString::free_string(static_cast<ObjString*>(object));
+            break;
+        case OBJ_ROPE:
+            delete static_cast<ObjRope*>(object);
+            break;
+    }
 }
 
 template <typename stream_type>
@@ -39,8 +44,12 @@ void Obj::print_object(const Value &value, stream_type &output) {
         case OBJ_STRING:
             output << AS_CSTRING(value);
             break;
+        case OBJ_ROPE:
+            output << AS_ROPE(value)->flatten()->chars();
+            break;
     }
 }
 
 template void Obj::print_object(const Value&, std::ostream&);
-template void Obj::print_object(const Value&, std::stringstream&);
\ No newline at end of file
+template void Obj::print_object(const Value&, std::stringstream&);
+template void Obj::print_object(const Value&, OutputBuffer&);
\ No newline at end of file
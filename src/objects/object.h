@@ -5,6 +5,7 @@
 
 enum ObjType {
     OBJ_STRING,
+    OBJ_ROPE,
 };
 
 #define OBJ_TYPE(value)        (AS_OBJ(value)->m_type)
@@ -13,17 +14,19 @@ enum ObjType {
 
 struct ObjString;
 
+// Objects have no vtable; anything type specific switches on m_type.
 struct Obj {
     ObjType m_type;
+    bool m_is_marked {false};
     Obj* m_next {nullptr};
 
-    Obj();
-    virtual ~Obj();
+    explicit Obj(ObjType type);
 
+    // Links the object into the VM's object list.
     void allocate_object();
-
-    virtual Obj* clone();
-    virtual Obj* copy();
+    // The size reported to track_allocation() when the object was created.
+    size_t allocated_size() const;
+    static void free_object(Obj* object);
 
     static inline bool is_obj_type(Value value, ObjType type) {
         return IS_OBJ(value) && AS_OBJ(value)->m_type == type;
@@ -31,4 +34,4 @@ struct Obj {
 
     template <typename stream_type>
     static void print_object(const Value &value, stream_type &output);
-};
\ No newline at end of file
+};
@@ -0,0 +1,76 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "objrope.h"
+#include "objstring.h"
+#include "../memory.h"
+
+ObjRope::ObjRope(Obj* left, Obj* right, uint32_t length): Obj(OBJ_ROPE) {
+    m_left = left;
+    m_right = right;
+    m_length = length;
+}
+
+// The operands must stay reachable by the collector until this returns.
+Obj* ObjRope::concatenate(Obj* a, Obj* b) {
+    // Widened first so that two long operands cannot wrap around.
+    uint64_t length = static_cast<uint64_t>(length_of(a)) + length_of(b);
+    if (length > MAX_STRING_LENGTH) return nullptr;
+
+    // Every rope is at least ROPE_MIN_LENGTH long, so short results only
+    // ever join two flat strings.
+    if (length < ROPE_MIN_LENGTH && a->m_type == OBJ_STRING && b->m_type == OBJ_STRING) {
+        return ObjString::concatenate(static_cast<ObjString*>(a), static_cast<ObjString*>(b));
+    }
+
+    track_allocation(sizeof(ObjRope));
+    ObjRope* rope = new ObjRope {a, b, static_cast<uint32_t>(length)};
+    rope->allocate_object();
+    return rope;
+}
+
+uint32_t ObjRope::length_of(const Obj* text) {
+    if (text->m_type == OBJ_ROPE) return static_cast<const ObjRope*>(text)->m_length;
+    return static_cast<const ObjString*>(text)->m_length;
+}
+
+Value ObjRope::flattened(const Value &value) {
+    if (!IS_ROPE(value)) return value;
+    return OBJ_VAL(AS_ROPE(value)->flatten());
+}
+
+// The rope must stay reachable by the collector until this returns.
+ObjString* ObjRope::flatten() {
+    if (m_flat != nullptr) return m_flat;
+
+    // Walk the tree right to left, filling the buffer from its end. An
+    // explicit stack keeps long chains of appends from overflowing.
+    ObjString* string = ObjString::reserve_string(m_length);
+    char* end = string->chars() + m_length;
+    std::vector<const Obj*> pending {m_left, m_right};
+    while (!pending.empty()) {
+        const Obj* node = pending.back();
+        pending.pop_back();
+
+        const ObjString* piece = nullptr;
+        if (node->m_type == OBJ_ROPE) {
+            const ObjRope* rope = static_cast<const ObjRope*>(node);
+            if (rope->m_flat == nullptr) {
+                pending.push_back(rope->m_left);
+                pending.push_back(rope->m_right);
+                continue;
+            }
+            piece = rope->m_flat;
+        } else {
+            piece = static_cast<const ObjString*>(node);
+        }
+
+        end -= piece->m_length;
+        memcpy(end, piece->chars(), piece->m_length);
+    }
+
+    m_flat = ObjString::take_string(string);
+    m_left = nullptr;
+    m_right = nullptr;
+    return m_flat;
+}
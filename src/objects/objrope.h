@@ -0,0 +1,37 @@
+#pragma once
+
+#include "common.h"
+#include "../value.h"
+#include "object.h"
+
+#define IS_ROPE(value)         Obj::is_obj_type(value, OBJ_ROPE)
+#define AS_ROPE(value)         ((ObjRope*)AS_OBJ(value))
+
+// A value that can be concatenated: a string or a rope.
+#define IS_TEXT(value)         (IS_STRING(value) || IS_ROPE(value))
+
+// Concatenations at least this long become ropes instead of being copied.
+#define ROPE_MIN_LENGTH 256
+
+struct ObjString;
+
+// The deferred result of concatenating two strings or ropes. Its characters
+// are only gathered into an interned ObjString when the rope is printed or
+// compared, so building a string up in a loop stays linear.
+struct ObjRope: Obj {
+    ObjRope(Obj* left, Obj* right, uint32_t length);
+
+    // Returns nullptr if the result would be longer than MAX_STRING_LENGTH.
+    static Obj* concatenate(Obj* a, Obj* b);
+    static uint32_t length_of(const Obj* text);
+    // Flattens value if it is a rope; other values are returned unchanged.
+    static Value flattened(const Value &value);
+
+    ObjString* flatten();
+
+    // Both are cleared once the rope has been flattened into m_flat.
+    Obj* m_left {nullptr};
+    Obj* m_right {nullptr};
+    ObjString* m_flat {nullptr};
+    uint32_t m_length {0};
+};
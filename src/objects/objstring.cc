@@ -1,57 +1,100 @@
-// #include "object.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <new>
+
 #include "objstring.h"
+#include "../memory.h"
 #include "../vm.h"
 
 extern VM vm;
 
-ObjString::~ObjString() {
-    // std::cout << "OBJSTRING DESTRUCTOR" << std::endl;
+ObjString::ObjString(uint32_t length): Obj(OBJ_STRING) {
+    m_length = length;
 }
 
 ObjString* ObjString::copy_string(const char* chars, size_t length) {
-  return allocate_string(chars, length);
+    uint32_t hash = hash_string(chars, length);
+    ObjString* interned = vm.m_strings.find_string(chars, length, hash);
+    if (interned != nullptr) return interned;
+
+    ObjString* string = reserve_string(length);
+    memcpy(string->chars(), chars, length);
+    string->m_hash = hash;
+    return adopt_string(string);
 }
 
-ObjString* ObjString::allocate_string(const char* chars, size_t length) {
-    // vm.strings.emplace(std::make_pair(std::string{chars, length}, std::move(NIL_VAL)));
-    return new ObjString {OBJ_STRING, chars, length};
+ObjString* ObjString::concatenate(const ObjString* a, const ObjString* b) {
+    size_t length = static_cast<size_t>(a->m_length) + b->m_length;
+
+    // Short results are often already interned, so join them on the stack
+    // and only allocate on a miss.
+    char buffer[256];
+    if (length <= sizeof(buffer)) {
+        memcpy(buffer, a->chars(), a->m_length);
+        memcpy(buffer + a->m_length, b->chars(), b->m_length);
+        return copy_string(buffer, length);
+    }
+
+    ObjString* string = reserve_string(length);
+    memcpy(string->chars(), a->chars(), a->m_length);
+    memcpy(string->chars() + a->m_length, b->chars(), b->m_length);
+    return take_string(string);
 }
 
-ObjString* ObjString::take_string(std::string &str) {
-    return new ObjString {OBJ_STRING, str.c_str(), str.length()};
+// Returns a string with room for length characters that is not yet known
+// to the VM. Fill in chars() and pass it to take_string(). Callers keep
+// length within MAX_STRING_LENGTH; anything longer cannot be stored, so it
+// ends the program rather than being truncated.
+ObjString* ObjString::reserve_string(size_t length) {
+    if (length > MAX_STRING_LENGTH) {
+        fprintf(stderr, "String too long.\n");
+        exit(70);
+    }
+    void* memory = ::operator new(sizeof(ObjString) + length + 1);
+    ObjString* string = new (memory) ObjString {static_cast<uint32_t>(length)};
+    string->chars()[length] = '\0';
+    return string;
 }
 
-ObjString::ObjString(ObjType type, const char* chars, size_t length): Obj() {
-    // std::cout << "OBJSTR CONSTRUCTOR" << std::endl;
-    m_type = type;
-    m_str = std::make_shared<std::string>(chars, length);
+// Takes ownership of a string from reserve_string(), returning the interned
+// copy instead if one already exists.
+ObjString* ObjString::take_string(ObjString* string) {
+    string->m_hash = hash_string(string->chars(), string->m_length);
+
+    ObjString* interned = vm.m_strings.find_string(string->chars(), string->m_length, string->m_hash);
+    if (interned != nullptr) {
+        free_string(string);
+        return interned;
+    }
+
+    return adopt_string(string);
 }
 
-ObjString::ObjString(const ObjString &other) : Obj() {
-    // std::cout << "OBJSTR COPY CONSTRUCTOR" << std::endl;
-    m_type = other.m_type;
-    m_str = other.m_str;
-    // std::cout << "This str: " << (void*)str.c_str() << std::endl;
-    // std::cout << str << std::endl;
-    // std::cout << "Other str: " << (void*)other.str.c_str() << std::endl;
-    // std::cout << other.str << std::endl;
+ObjString* ObjString::intern(ObjString* string) {
+    vm.m_strings.set(string, NIL_VAL);
+    return string;
 }
 
-ObjString::ObjString(std::string &str) : Obj() {
-    // std::cout << "OBJSTR STRING CONSTRUCTOR" << std::endl;
-    m_type = OBJ_STRING;
-    m_str = std::make_shared<std::string>(std::move(str));
+// FNV-1a
+uint32_t ObjString::hash_string(const char* key, size_t length) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; i++) {
+        hash ^= (uint8_t)key[i];
+        hash *= 16777619;
+    }
+    return hash;
 }
 
-ObjString* ObjString::clone() {
-    // std::cout << "OBJSTRING CLONED" << std::endl;
-    return new ObjString (*this);
+void ObjString::free_string(ObjString* string) {
+    string->~ObjString();
+    ::operator delete(string);
 }
 
-ObjString* ObjString::copy() {
-    // std::cout << "OBJSTRING COPIED" << std::endl;
-    auto result = new ObjString {};
-    result->m_type = m_type;
-    result->m_str = m_str;
-    return result;
-}
\ No newline at end of file
+// Hands a freshly filled string over to the collector and the intern table.
+ObjString* ObjString::adopt_string(ObjString* string) {
+    track_allocation(string->allocated_size());
+    string->allocate_object();
+    return intern(string);
+}
@@ -1,27 +1,43 @@
 #pragma once
 
+#include <string_view>
+
 #include "common.h"
 #include "../value.h"
 #include "object.h"
 
 #define AS_STRING(value)       ((ObjString*)AS_OBJ(value))
-#define AS_CSTRING(value)      (((ObjString*)AS_OBJ(value))->m_str->c_str())
+#define AS_CSTRING(value)      (((ObjString*)AS_OBJ(value))->chars())
 
-struct ObjString: Obj {
-    ObjString() = default;
-    ObjString(ObjType type, const char* chars, size_t length);
-    ObjString(const ObjString& other);
-    ObjString(std::string &str);
-    ~ObjString();
-    ObjString* clone() override;
-    ObjString* copy() override;
+// Lengths are stored in 32 bits.
+#define MAX_STRING_LENGTH UINT32_MAX
 
+// A string is a single allocation: the null-terminated characters are stored
+// directly after the header.
+struct ObjString: Obj {
     static ObjString* copy_string(const char* chars, size_t length);
-    static ObjString* allocate_string(const char* chars, size_t length);
-    static ObjString* take_string(std::string &str);   
-
-    std::shared_ptr<std::string> m_str {};
+    static ObjString* concatenate(const ObjString* a, const ObjString* b);
+    static ObjString* reserve_string(size_t length);
+    static ObjString* take_string(ObjString* string);
+    static ObjString* intern(ObjString* string);
+    static uint32_t hash_string(const char* key, size_t length);
+    static void free_string(ObjString* string);
+
+    inline char* chars() {
+        return reinterpret_cast<char*>(this + 1);
+    }
+    inline const char* chars() const {
+        return reinterpret_cast<const char*>(this + 1);
+    }
+    inline std::string_view view() const {
+        return std::string_view {chars(), m_length};
+    }
+
+    uint32_t m_hash {0};
+    uint32_t m_length {0};
+
+private:
+    ObjString(uint32_t length);
+
+    static ObjString* adopt_string(ObjString* string);
 };
-
-
-
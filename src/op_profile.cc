@@ -0,0 +1,63 @@
+#include <algorithm>
+#include <iostream>
+#include <vector>
+
+#include "op_profile.h"
+#include "debug.h"
+#include "util.h"
+
+#define PROFILE_TOP_PAIRS 25
+
+void OpProfile::finish() {
+    if (m_previous >= 0) {
+        m_cycles[m_previous] += timestamp() - m_previous_start;
+    }
+    m_previous = -1;
+}
+
+void OpProfile::print(std::ostream &out) const {
+    uint64_t total = 0;
+    uint64_t total_cycles = 0;
+    std::vector<int> ops {};
+    for (int op = 0; op < OPCODE_COUNT; op++) {
+        total += m_counts[op];
+        total_cycles += m_cycles[op];
+        if (m_counts[op] > 0) ops.push_back(op);
+    }
+    std::sort(ops.begin(), ops.end(), [&](int a, int b) { return m_counts[a] > m_counts[b]; });
+
+    out << "== opcode profile ==" << std::endl;
+    out << string_format("%-32s %14s %7s %16s %7s %9s\n",
+                         "opcode", "count", "%", "cycles", "%", "cycles/op");
+    for (int op : ops) {
+        out << string_format("%-32s %14llu %6.2f%% %16llu %6.2f%% %9.1f\n", opcode_name(op),
+                             (unsigned long long)m_counts[op], 100.0 * m_counts[op] / total,
+                             (unsigned long long)m_cycles[op],
+                             total_cycles ? 100.0 * m_cycles[op] / total_cycles : 0.0,
+                             (double)m_cycles[op] / m_counts[op]);
+    }
+    out << string_format("%-32s %14llu\n\n", "total", (unsigned long long)total);
+
+    std::vector<std::pair<int, int>> pairs {};
+    uint64_t total_pairs = 0;
+    for (int first = 0; first < OPCODE_COUNT; first++) {
+        for (int second = 0; second < OPCODE_COUNT; second++) {
+            if (m_pairs[first][second] == 0) continue;
+            pairs.push_back({first, second});
+            total_pairs += m_pairs[first][second];
+        }
+    }
+    std::sort(pairs.begin(), pairs.end(), [&](const auto &a, const auto &b) {
+        return m_pairs[a.first][a.second] > m_pairs[b.first][b.second];
+    });
+    if (pairs.size() > PROFILE_TOP_PAIRS) pairs.resize(PROFILE_TOP_PAIRS);
+
+    out << "== opcode pairs ==" << std::endl;
+    for (auto [first, second] : pairs) {
+        std::string pair = string_format("%s -> %s", opcode_name(first), opcode_name(second));
+        out << string_format("%-64s %14llu %6.2f%%\n", pair.c_str(),
+                             (unsigned long long)m_pairs[first][second],
+                             100.0 * m_pairs[first][second] / total_pairs);
+    }
+    out << std::endl;
+}
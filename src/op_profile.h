@@ -0,0 +1,50 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <iosfwd>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "chunk.h"
+
+// Execution counts and cycles per opcode, and counts per pair of consecutive
+// opcodes, gathered by VM::run() in builds with PROFILE_OPS. The time between
+// two dispatches is charged to the first opcode, so an opcode's cycles
+// include its share of dispatch.
+struct OpProfile {
+    std::array<uint64_t, OPCODE_COUNT> m_counts {};
+    std::array<uint64_t, OPCODE_COUNT> m_cycles {};
+    std::array<std::array<uint64_t, OPCODE_COUNT>, OPCODE_COUNT> m_pairs {};
+    int m_previous {-1};
+    uint64_t m_previous_start {0};
+
+    static inline uint64_t timestamp() {
+#if defined(__x86_64__) || defined(__i386__)
+        return __rdtsc();
+#else
+        return std::chrono::steady_clock::now().time_since_epoch().count();
+#endif
+    }
+
+    // Called as each instruction is dispatched; returns op for the dispatch.
+    inline uint8_t record(uint8_t op) {
+        uint64_t now = timestamp();
+        if (m_previous >= 0) {
+            m_cycles[m_previous] += now - m_previous_start;
+            m_pairs[m_previous][op]++;
+        }
+        m_counts[op]++;
+        m_previous = op;
+        m_previous_start = now;
+        return op;
+    }
+
+    // Closes the running opcode's interval, at the end of a run.
+    void finish();
+
+    // Writes the opcodes sorted by count, then the most frequent pairs.
+    void print(std::ostream &out) const;
+};
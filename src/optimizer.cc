@@ -0,0 +1,532 @@
+#include <algorithm>
+#include <bit>
+#include <vector>
+
+#include "optimizer.h"
+
+namespace {
+
+int operand_size(uint8_t op) {
+    switch (op) {
+        case OP_CONSTANT:
+        case OP_GET_LOCAL:
+        case OP_SET_LOCAL:
+            return 1;
+        case OP_GET_GLOBAL:
+        case OP_SET_GLOBAL:
+        case OP_DEFINE_GLOBAL:
+        case OP_ADD_LOCAL_CONSTANT:
+        case OP_SUBTRACT_LOCAL_CONSTANT:
+        case OP_JUMP:
+        case OP_JUMP_IF_FALSE:
+        case OP_POP_JUMP_IF_FALSE:
+        case OP_LESS_JUMP_IF_FALSE:
+        case OP_LESS_EQUAL_JUMP_IF_FALSE:
+        case OP_GREATER_JUMP_IF_FALSE:
+        case OP_GREATER_EQUAL_JUMP_IF_FALSE:
+        case OP_LOOP:
+            return 2;
+        case OP_CONSTANT_LONG:
+            return 3;
+        default:
+            return 0;
+    }
+}
+
+}
+
+bool is_jump_op(uint8_t op) {
+    switch (op) {
+        case OP_JUMP:
+        case OP_JUMP_IF_FALSE:
+        case OP_POP_JUMP_IF_FALSE:
+        case OP_LESS_JUMP_IF_FALSE:
+        case OP_LESS_EQUAL_JUMP_IF_FALSE:
+        case OP_GREATER_JUMP_IF_FALSE:
+        case OP_GREATER_EQUAL_JUMP_IF_FALSE:
+        case OP_LOOP:
+            return true;
+        default:
+            return false;
+    }
+}
+
+bool decode_code(const uint8_t* bytes, int size, const std::vector<LineStart> &lines, int start,
+                 std::vector<DecodedInstruction> &code) {
+    std::vector<int> index_at(size + 1, -1);
+    std::vector<int> jump_offsets {};
+    // Most instructions carry an operand, so this is about enough.
+    code.clear();
+    code.reserve((size - start) / 2);
+    jump_offsets.reserve((size - start) / 2);
+
+    // Offsets only grow, so the line runs are walked alongside them rather
+    // than searched for each instruction.
+    size_t next_run = 0;
+    int line = 0;
+
+    for (int offset = start; offset < size;) {
+        while (next_run < lines.size() && lines[next_run].offset <= offset) {
+            line = lines[next_run++].line;
+        }
+        DecodedInstruction instruction {bytes[offset]};
+        instruction.line = line;
+        int operand_bytes = operand_size(instruction.op);
+        if (instruction.op >= OPCODE_COUNT || operand_bytes >= size - offset) return false;
+        for (int i = 1; i <= operand_bytes; i++) {
+            instruction.operand = (instruction.operand << 8) | bytes[offset + i];
+        }
+        index_at[offset] = code.size();
+        offset += 1 + operand_bytes;
+
+        if (is_jump_op(instruction.op)) {
+            int jump = instruction.operand;
+            jump_offsets.push_back(instruction.op == OP_LOOP ? offset - jump : offset + jump);
+        } else {
+            jump_offsets.push_back(0);
+        }
+        code.push_back(instruction);
+    }
+
+    for (size_t i = 0; i < code.size(); i++) {
+        if (!is_jump_op(code[i].op)) continue;
+        // Jumps have to land on an instruction inside the decoded range.
+        if (jump_offsets[i] < start || jump_offsets[i] >= size || index_at[jump_offsets[i]] < 0) {
+            return false;
+        }
+        code[i].target = index_at[jump_offsets[i]];
+        code[code[i].target].is_jump_target = true;
+    }
+    return true;
+}
+
+std::vector<DecodedInstruction> decode_chunk(const Chunk &chunk, int start) {
+    std::vector<DecodedInstruction> code {};
+    decode_code(chunk.data(), chunk.size(), chunk.lines(), start, code);
+    return code;
+}
+
+namespace {
+
+bool is_constant(const DecodedInstruction &instruction) {
+    switch (instruction.op) {
+        case OP_CONSTANT:
+        case OP_CONSTANT_LONG:
+        case OP_NIL:
+        case OP_TRUE:
+        case OP_FALSE:
+            return true;
+        default:
+            return false;
+    }
+}
+
+Value constant_value(const Chunk &chunk, const DecodedInstruction &instruction) {
+    switch (instruction.op) {
+        case OP_NIL: return NIL_VAL;
+        case OP_TRUE: return BOOL_VAL(true);
+        case OP_FALSE: return BOOL_VAL(false);
+        default: return chunk.constants()[instruction.operand];
+    }
+}
+
+DecodedInstruction load_constant(Chunk &chunk, const Value &value, const DecodedInstruction &at) {
+    DecodedInstruction instruction {at};
+    instruction.operand = 0;
+    if (IS_BOOL(value)) {
+        instruction.op = AS_BOOL(value) ? OP_TRUE : OP_FALSE;
+    } else if (IS_NIL(value)) {
+        instruction.op = OP_NIL;
+    } else {
+        int constant = chunk.add_constant(value);
+        instruction.op = constant > UINT8_MAX ? OP_CONSTANT_LONG : OP_CONSTANT;
+        instruction.operand = constant;
+    }
+    return instruction;
+}
+
+bool is_number_constant(const Chunk &chunk, const DecodedInstruction &instruction, double number) {
+    if (instruction.op != OP_CONSTANT && instruction.op != OP_CONSTANT_LONG) return false;
+    Value value = chunk.constants()[instruction.operand];
+    return IS_NUMBER(value) &&
+        std::bit_cast<uint64_t>(AS_NUMBER(value)) == std::bit_cast<uint64_t>(number);
+}
+
+// Instructions that always leave a bool on the stack.
+bool produces_bool(uint8_t op) {
+    switch (op) {
+        case OP_TRUE:
+        case OP_FALSE:
+        case OP_NOT:
+        case OP_EQUAL:
+        case OP_NOT_EQUAL:
+        case OP_GREATER:
+        case OP_GREATER_EQUAL:
+        case OP_LESS:
+        case OP_LESS_EQUAL:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// Instructions that either leave a number on the stack or fail at runtime.
+// OP_ADD is left out since it also concatenates strings.
+bool produces_number(const Chunk &chunk, const DecodedInstruction &instruction) {
+    switch (instruction.op) {
+        case OP_SUBTRACT:
+        case OP_MULTIPLY:
+        case OP_DIVIDE:
+        case OP_NEGATE:
+            return true;
+        case OP_CONSTANT:
+        case OP_CONSTANT_LONG:
+            return IS_NUMBER(chunk.constants()[instruction.operand]);
+        default:
+            return false;
+    }
+}
+
+// Evaluates a binary operator over two constants. Returns false when the
+// operation would be a runtime error, so that it is left for the VM to report.
+bool fold_binary(uint8_t op, const Value &a, const Value &b, Value &result) {
+    if (op == OP_EQUAL || op == OP_NOT_EQUAL) {
+        result = BOOL_VAL((a == b) == (op == OP_EQUAL));
+        return true;
+    }
+    if (!IS_NUMBER(a) || !IS_NUMBER(b)) return false;
+
+    double x = AS_NUMBER(a);
+    double y = AS_NUMBER(b);
+    switch (op) {
+        case OP_GREATER: result = BOOL_VAL(x > y); return true;
+        case OP_LESS: result = BOOL_VAL(x < y); return true;
+        case OP_GREATER_EQUAL: result = BOOL_VAL(!(x < y)); return true;
+        case OP_LESS_EQUAL: result = BOOL_VAL(!(x > y)); return true;
+        case OP_ADD: result = NUMBER_VAL(x + y); return true;
+        case OP_SUBTRACT: result = NUMBER_VAL(x - y); return true;
+        case OP_MULTIPLY: result = NUMBER_VAL(x * y); return true;
+        case OP_DIVIDE: result = NUMBER_VAL(x / y); return true;
+        default: return false;
+    }
+}
+
+bool fold_unary(uint8_t op, const Value &a, Value &result) {
+    switch (op) {
+        case OP_NOT:
+            result = BOOL_VAL(a.is_falsey());
+            return true;
+        case OP_NEGATE:
+            if (!IS_NUMBER(a)) return false;
+            result = NUMBER_VAL(-AS_NUMBER(a));
+            return true;
+        default:
+            return false;
+    }
+}
+
+struct Optimizer {
+    Chunk &m_chunk;
+    const std::vector<DecodedInstruction> &m_code;
+    std::vector<DecodedInstruction> m_out {};
+
+    // Whether the last `count` emitted instructions can be merged with the
+    // one before them, i.e. none of them is reached by a jump.
+    bool mergeable(int count) const {
+        if (m_out.size() <= static_cast<size_t>(count)) return false;
+        for (int i = 1; i <= count; i++) {
+            if (m_out[m_out.size() - i].is_jump_target) return false;
+        }
+        return true;
+    }
+
+    const DecodedInstruction& back(int distance) const {
+        return m_out[m_out.size() - 1 - distance];
+    }
+
+    // A value produced right before `index` that is only tested for
+    // truthiness and then discarded: `index` is a pop or OP_POP_JUMP_IF_FALSE,
+    // or an OP_JUMP_IF_FALSE whose both successors start with a pop.
+    bool only_truthiness_used(int index) const {
+        if (static_cast<size_t>(index) >= m_code.size()) return false;
+        const DecodedInstruction &next = m_code[index];
+        if (next.op == OP_POP || next.op == OP_POP_JUMP_IF_FALSE) return !next.is_jump_target;
+        if (next.op != OP_JUMP_IF_FALSE || next.is_jump_target) return false;
+        return static_cast<size_t>(index) + 1 < m_code.size() && m_code[index + 1].op == OP_POP &&
+            m_code[next.target].op == OP_POP;
+    }
+
+    bool simplify(int index) {
+        const DecodedInstruction &instruction = m_code[index];
+        if (instruction.is_jump_target) return false;
+        uint8_t op = instruction.op;
+
+        switch (op) {
+            case OP_POP:
+                // A constant pushed only to be popped again.
+                if (mergeable(0) && is_constant(back(0)) && !back(0).is_jump_target) {
+                    m_out.pop_back();
+                    return true;
+                }
+                return false;
+
+            case OP_NOT:
+            case OP_NEGATE: {
+                if (m_out.empty()) return false;
+                Value result {};
+                if (is_constant(back(0)) &&
+                    fold_unary(op, constant_value(m_chunk, back(0)), result)) {
+                    m_out.back() = load_constant(m_chunk, result, back(0));
+                    return true;
+                }
+                if (back(0).op != op || !mergeable(1)) return false;
+                // !!x is x for bools, and -(-x) is x for numbers.
+                bool same = op == OP_NOT
+                    ? produces_bool(back(1).op) || only_truthiness_used(index + 1)
+                    : produces_number(m_chunk, back(1));
+                if (!same) return false;
+                m_out.pop_back();
+                return true;
+            }
+
+            case OP_EQUAL:
+            case OP_NOT_EQUAL:
+            case OP_GREATER:
+            case OP_GREATER_EQUAL:
+            case OP_LESS:
+            case OP_LESS_EQUAL:
+            case OP_ADD:
+            case OP_SUBTRACT:
+            case OP_MULTIPLY:
+            case OP_DIVIDE: {
+                if (!mergeable(1)) return false;
+                Value result {};
+                if (is_constant(back(1)) && is_constant(back(0)) &&
+                    fold_binary(op, constant_value(m_chunk, back(1)),
+                                constant_value(m_chunk, back(0)), result)) {
+                    DecodedInstruction folded = load_constant(m_chunk, result, back(1));
+                    m_out.pop_back();
+                    m_out.back() = folded;
+                    return true;
+                }
+                // x * 1, x / 1 and x - 0 when x is known to be a number. x + 0
+                // is not an identity since -0 + 0 is 0.
+                bool identity =
+                    ((op == OP_MULTIPLY || op == OP_DIVIDE) && is_number_constant(m_chunk, back(0), 1)) ||
+                    (op == OP_SUBTRACT && is_number_constant(m_chunk, back(0), 0));
+                if (identity && produces_number(m_chunk, back(1))) {
+                    m_out.pop_back();
+                    return true;
+                }
+                return false;
+            }
+
+            default:
+                return false;
+        }
+    }
+
+    void run() {
+        std::vector<int> new_index(m_code.size(), -1);
+        m_out.reserve(m_code.size());
+        for (size_t i = 0; i < m_code.size(); i++) {
+            if (simplify(i)) continue;
+            new_index[i] = m_out.size();
+            m_out.push_back(m_code[i]);
+        }
+        // Only instructions that no jump lands on are ever removed, so every
+        // target still has an index.
+        for (DecodedInstruction &instruction : m_out) {
+            if (is_jump_op(instruction.op)) instruction.target = new_index[instruction.target];
+        }
+    }
+};
+
+// Replaces `OP_GET_LOCAL; OP_CONSTANT; op` and `compare; OP_POP_JUMP_IF_FALSE`
+// with a single instruction when no jump lands inside the sequence.
+struct Fuser {
+    const Chunk &m_chunk;
+    const std::vector<DecodedInstruction> &m_code;
+    std::vector<DecodedInstruction> m_out {};
+
+    static uint8_t local_constant_op(uint8_t op) {
+        switch (op) {
+            case OP_ADD: return OP_ADD_LOCAL_CONSTANT;
+            case OP_SUBTRACT: return OP_SUBTRACT_LOCAL_CONSTANT;
+            default: return 0;
+        }
+    }
+
+    static uint8_t compare_jump_op(uint8_t op) {
+        switch (op) {
+            case OP_LESS: return OP_LESS_JUMP_IF_FALSE;
+            case OP_LESS_EQUAL: return OP_LESS_EQUAL_JUMP_IF_FALSE;
+            case OP_GREATER: return OP_GREATER_JUMP_IF_FALSE;
+            case OP_GREATER_EQUAL: return OP_GREATER_EQUAL_JUMP_IF_FALSE;
+            default: return 0;
+        }
+    }
+
+    // Fuses the instructions starting at `index` into m_out and returns how
+    // many were consumed, or 0 if nothing applies.
+    int fuse(int index) {
+        const DecodedInstruction &first = m_code[index];
+        auto inside_block = [&](int count) {
+            if (static_cast<size_t>(index + count) > m_code.size()) return false;
+            for (int i = 1; i < count; i++) {
+                if (m_code[index + i].is_jump_target) return false;
+            }
+            return true;
+        };
+
+        // Only number constants are fused, so the handlers never concatenate.
+        if (first.op == OP_GET_LOCAL && inside_block(3)) {
+            const DecodedInstruction &constant = m_code[index + 1];
+            uint8_t op = local_constant_op(m_code[index + 2].op);
+            if (op != 0 && constant.op == OP_CONSTANT &&
+                IS_NUMBER(m_chunk.constants()[constant.operand])) {
+                DecodedInstruction fused {first};
+                fused.op = op;
+                fused.operand = (first.operand << 8) | constant.operand;
+                m_out.push_back(fused);
+                return 3;
+            }
+        }
+
+        uint8_t op = compare_jump_op(first.op);
+        if (op != 0 && inside_block(2) && m_code[index + 1].op == OP_POP_JUMP_IF_FALSE) {
+            DecodedInstruction fused {m_code[index + 1]};
+            fused.op = op;
+            fused.line = first.line;
+            fused.is_jump_target = first.is_jump_target;
+            m_out.push_back(fused);
+            return 2;
+        }
+        return 0;
+    }
+
+    void run() {
+        std::vector<int> new_index(m_code.size(), -1);
+        m_out.reserve(m_code.size());
+        for (size_t i = 0; i < m_code.size();) {
+            new_index[i] = m_out.size();
+            int consumed = fuse(i);
+            if (consumed == 0) {
+                m_out.push_back(m_code[i]);
+                consumed = 1;
+            }
+            i += consumed;
+        }
+        for (DecodedInstruction &instruction : m_out) {
+            if (is_jump_op(instruction.op)) instruction.target = new_index[instruction.target];
+        }
+    }
+};
+
+int instruction_size(const DecodedInstruction &instruction) {
+    return 1 + operand_size(instruction.op);
+}
+
+// Where each instruction of code starts once emitted from start, followed by
+// where the code ends.
+std::vector<int> emitted_offsets(const std::vector<DecodedInstruction> &code, int start) {
+    std::vector<int> offsets(code.size() + 1);
+    offsets[0] = start;
+    for (size_t i = 0; i < code.size(); i++) {
+        offsets[i + 1] = offsets[i] + instruction_size(code[i]);
+    }
+    return offsets;
+}
+
+int jump_distance(const std::vector<DecodedInstruction> &code, const std::vector<int> &offsets, size_t index) {
+    int target = offsets[code[index].target];
+    return code[index].op == OP_LOOP ? offsets[index + 1] - target : target - offsets[index + 1];
+}
+
+// Rewriting can lengthen code, e.g. when a fold turns OP_CONSTANT and
+// OP_NEGATE into OP_CONSTANT_LONG, so a jump the compiler could encode may no
+// longer fit in its 16-bit operand.
+bool jumps_fit(const std::vector<DecodedInstruction> &code, int start) {
+    std::vector<int> offsets = emitted_offsets(code, start);
+    for (size_t i = 0; i < code.size(); i++) {
+        if (is_jump_op(code[i].op) && jump_distance(code, offsets, i) > UINT16_MAX) return false;
+    }
+    return true;
+}
+
+void emit(Chunk &chunk, const std::vector<DecodedInstruction> &code, int start) {
+    std::vector<int> offsets = emitted_offsets(code, start);
+
+    chunk.truncate_code(start);
+    for (size_t i = 0; i < code.size(); i++) {
+        const DecodedInstruction &instruction = code[i];
+        uint32_t operand = instruction.operand;
+        if (is_jump_op(instruction.op)) operand = jump_distance(code, offsets, i);
+
+        chunk.write_chunk(instruction.op, instruction.line);
+        for (int shift = 8 * (operand_size(instruction.op) - 1); shift >= 0; shift -= 8) {
+            chunk.write_chunk((operand >> shift) & 0xff, instruction.line);
+        }
+    }
+}
+
+// Folding replaces the operands it consumes with a new constant, leaving the
+// old ones, and any intermediate results, in the pool. Keeps the constants
+// from constant_start on that code still loads, in their original order, and
+// renumbers the loads to match. Loads that now fit in a byte lose their long
+// form. Constants before constant_start may be loaded by earlier code units
+// that are not in code, so they are kept.
+void compact_constants(Chunk &chunk, std::vector<DecodedInstruction> &code, int constant_start) {
+    size_t count = chunk.constants().size();
+    if (count <= static_cast<size_t>(constant_start)) return;
+
+    std::vector<bool> used(count, false);
+    for (const DecodedInstruction &instruction : code) {
+        if (instruction.op == OP_CONSTANT || instruction.op == OP_CONSTANT_LONG) {
+            used[instruction.operand] = true;
+        }
+    }
+    if (std::all_of(used.begin() + constant_start, used.end(), [](bool u) { return u; })) return;
+
+    std::vector<Value> kept {};
+    for (size_t i = constant_start; i < count; i++) {
+        if (used[i]) kept.push_back(chunk.constants()[i]);
+    }
+    std::vector<int> renumbered(count, -1);
+    chunk.truncate_constants(constant_start);
+    for (size_t i = constant_start, next = 0; i < count; i++) {
+        if (used[i]) renumbered[i] = chunk.add_constant(kept[next++]);
+    }
+
+    for (DecodedInstruction &instruction : code) {
+        if (instruction.op != OP_CONSTANT && instruction.op != OP_CONSTANT_LONG) continue;
+        if (instruction.operand < static_cast<uint32_t>(constant_start)) continue;
+        instruction.operand = renumbered[instruction.operand];
+        instruction.op = instruction.operand > UINT8_MAX ? OP_CONSTANT_LONG : OP_CONSTANT;
+    }
+}
+
+}
+
+void optimize_chunk(Chunk &chunk, int start, int constant_start) {
+    std::vector<DecodedInstruction> code = decode_chunk(chunk, start);
+    int pool_size = chunk.constants().size();
+    Optimizer optimizer {chunk, code};
+    optimizer.run();
+    if (!jumps_fit(optimizer.m_out, start)) {
+        // Keep the code as compiled, without the constants folding added.
+        chunk.truncate_constants(pool_size);
+        return;
+    }
+    compact_constants(chunk, optimizer.m_out, constant_start);
+    emit(chunk, optimizer.m_out, start);
+}
+
+void fuse_superinstructions(Chunk &chunk, int start) {
+    std::vector<DecodedInstruction> code = decode_chunk(chunk, start);
+    Fuser fuser {chunk, code};
+    fuser.run();
+    if (fuser.m_out.size() != code.size() && jumps_fit(fuser.m_out, start)) {
+        emit(chunk, fuser.m_out, start);
+    }
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <vector>
+
+#include "chunk.h"
+
+// One bytecode instruction with its operand bytes combined, as read by
+// decode_chunk() for the passes that rewrite or translate a chunk.
+struct DecodedInstruction {
+    uint8_t op;
+    uint32_t operand {0};
+    int line {0};
+    // For jumps, the index of the instruction jumped to. Indices refer to the
+    // decoded instructions until the jumps are remapped.
+    int target {-1};
+    // Other instructions jump here, so it starts a basic block and may not be
+    // merged into the instructions before it.
+    bool is_jump_target {false};
+};
+
+bool is_jump_op(uint8_t op);
+// Decodes size bytes of code from offset start on, taking line numbers from
+// lines. Returns false if the bytes do not split into whole instructions with
+// known opcodes, or if a jump leaves the range or lands inside an
+// instruction, so it can be trusted with code from outside the compiler.
+bool decode_code(const uint8_t* bytes, int size, const std::vector<LineStart> &lines, int start,
+                 std::vector<DecodedInstruction> &code);
+// Decodes the code from offset start to the end of the chunk, which the
+// compiler produced and so is well formed.
+std::vector<DecodedInstruction> decode_chunk(const Chunk &chunk, int start = 0);
+
+// Peephole optimizer run over a finished chunk when the optimization level is
+// above zero. It folds constant subexpressions, drops redundant OP_NOT and
+// OP_NEGATE pairs and arithmetic identities, then re-emits the code with
+// jump offsets and line information rebuilt. Both passes only touch the code
+// from start on, so earlier code units in the chunk keep their offsets.
+// Constants from constant_start on belong to the same code; those that
+// folding left unused are dropped from the pool. Code that would come out
+// needing a jump longer than 16 bits is left as compiled.
+void optimize_chunk(Chunk &chunk, int start = 0, int constant_start = 0);
+
+// Replaces common instruction sequences with the superinstructions at the end
+// of OpCode. Run on every chunk, after optimize_chunk() if that is enabled.
+void fuse_superinstructions(Chunk &chunk, int start = 0);
@@ -0,0 +1,41 @@
+#include <cerrno>
+
+#include "output.h"
+
+FdSink::FdSink(int fd): m_fd {fd} {}
+
+void FdSink::write(const char* data, size_t size) {
+    while (size > 0) {
+        ssize_t written = ::write(m_fd, data, size);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            // Nowhere left to report it; drop the output as stdout would.
+            return;
+        }
+        data += written;
+        size -= written;
+    }
+}
+
+void StringSink::write(const char* data, size_t size) {
+    m_output.append(data, size);
+}
+
+OutputBuffer::~OutputBuffer() {
+    flush();
+}
+
+void OutputBuffer::set_sink(OutputSink* sink) {
+    flush();
+    m_sink = sink != nullptr ? sink : &m_stdout;
+}
+
+OutputSink* OutputBuffer::sink() const {
+    return m_sink;
+}
+
+void OutputBuffer::flush() {
+    if (m_size == 0) return;
+    m_sink->write(m_data, m_size);
+    m_size = 0;
+}
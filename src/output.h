@@ -0,0 +1,80 @@
+#pragma once
+
+#include <cstddef>
+#include <cstring>
+#include <string>
+
+#include <unistd.h>
+
+// Receives what scripts print. OutputBuffer hands text over in large pieces,
+// so a sink is called a few times per run rather than once per print.
+struct OutputSink {
+    virtual ~OutputSink() = default;
+    virtual void write(const char* data, size_t size) = 0;
+};
+
+// Writes to a file descriptor with write(2). The VM prints to one on stdout
+// unless given another sink.
+struct FdSink : OutputSink {
+    explicit FdSink(int fd);
+    void write(const char* data, size_t size) override;
+
+private:
+    int m_fd;
+};
+
+// Collects everything printed, for hosts that want a script's output as a
+// string.
+struct StringSink : OutputSink {
+    void write(const char* data, size_t size) override;
+
+    std::string m_output {};
+};
+
+#define OUTPUT_BUFFER_SIZE (64 * 1024)
+
+// Holds printed text until the buffer fills or flush() is called. The VM
+// flushes at the end of every run and before reporting a runtime error, so
+// output never trails the error it led up to.
+struct OutputBuffer {
+    OutputBuffer() = default;
+    OutputBuffer(const OutputBuffer&) = delete;
+    OutputBuffer& operator=(const OutputBuffer&) = delete;
+    ~OutputBuffer();
+
+    // Flushes what the old sink is owed first. nullptr goes back to stdout.
+    // The sink must outlive its use here.
+    void set_sink(OutputSink* sink);
+    OutputSink* sink() const;
+    void flush();
+
+    inline void write(const char* data, size_t size) {
+        if (size > OUTPUT_BUFFER_SIZE - m_size) {
+            flush();
+            // Too big to ever fit, so skip the copy.
+            if (size > OUTPUT_BUFFER_SIZE) {
+                m_sink->write(data, size);
+                return;
+            }
+        }
+        std::memcpy(m_data + m_size, data, size);
+        m_size += size;
+    }
+
+    inline void put(char c) {
+        if (m_size == OUTPUT_BUFFER_SIZE) flush();
+        m_data[m_size++] = c;
+    }
+
+    // Lets print_value() write here as it would to a stream.
+    inline OutputBuffer& operator<<(const char* text) {
+        write(text, std::strlen(text));
+        return *this;
+    }
+
+private:
+    char m_data[OUTPUT_BUFFER_SIZE];
+    size_t m_size {0};
+    FdSink m_stdout {STDOUT_FILENO};
+    OutputSink* m_sink {&m_stdout};
+};
@@ -1,111 +1,64 @@
 #include <memory>
-#include <functional>
 
 #include "parser.h"
 #include "token.h"
 #include "scanner.h"
 #include "compiler.h"
 
-// #define BIND_FUNC(name) std::bind(&name, &m_compiler)
-#define BIND_FUNC(name) ParseFn name = std::bind(&Compiler::name, &m_compiler, std::placeholders::_1)
+namespace {
+
+// Indexed by TokenType.
+constexpr ParseRule RULES[] = {
+    {&Compiler::grouping,   nullptr,               PREC_NONE},       // TOKEN_LEFT_PAREN
+    {nullptr,               nullptr,               PREC_NONE},       // TOKEN_RIGHT_PAREN
+    {nullptr,               nullptr,               PREC_NONE},       // TOKEN_LEFT_BRACE
+    {nullptr,               nullptr,               PREC_NONE},       // TOKEN_RIGHT_BRACE
+    {nullptr,               nullptr,               PREC_NONE},       // TOKEN_COMMA
+    {nullptr,               nullptr,               PREC_NONE},       // TOKEN_DOT
+    {&Compiler::unary,      &Compiler::binary,     PREC_TERM},       // TOKEN_MINUS
+    {nullptr,               &Compiler::binary,     PREC_TERM},       // TOKEN_PLUS
+    {nullptr,               nullptr,               PREC_NONE},       // TOKEN_SEMICOLON
+    {nullptr,               &Compiler::binary,     PREC_FACTOR},     // TOKEN_SLASH
+    {nullptr,               &Compiler::binary,     PREC_FACTOR},     // TOKEN_STAR
+    {&Compiler::unary,      nullptr,               PREC_NONE},       // TOKEN_BANG
+    {nullptr,               &Compiler::binary,     PREC_EQUALITY},   // TOKEN_BANG_EQUAL
+    {nullptr,               nullptr,               PREC_NONE},       // TOKEN_EQUAL
+    {nullptr,               &Compiler::binary,     PREC_EQUALITY},   // TOKEN_EQUAL_EQUAL
+    {nullptr,               &Compiler::binary,     PREC_COMPARISON}, // TOKEN_GREATER
+    {nullptr,               &Compiler::binary,     PREC_COMPARISON}, // TOKEN_GREATER_EQUAL
+    {nullptr,               &Compiler::binary,     PREC_COMPARISON}, // TOKEN_LESS
+    {nullptr,               &Compiler::binary,     PREC_COMPARISON}, // TOKEN_LESS_EQUAL
+    {&Compiler::variable,   nullptr,               PREC_NONE},       // TOKEN_IDENTIFIER
+    {&Compiler::string,     nullptr,               PREC_NONE},       // TOKEN_STRING
+    {&Compiler::number,     nullptr,               PREC_NONE},       // TOKEN_NUMBER
+    {nullptr,               &Compiler::and_,       PREC_AND},        // TOKEN_AND
+    {nullptr,               nullptr,               PREC_NONE},       // TOKEN_CLASS
+    {nullptr,               nullptr,               PREC_NONE},       // TOKEN_ELSE
+    {&Compiler::literal,    nullptr,               PREC_NONE},       // TOKEN_FALSE
+    {nullptr,               nullptr,               PREC_NONE},       // TOKEN_FOR
+    {nullptr,               nullptr,               PREC_NONE},       // TOKEN_FUN
+    {nullptr,               nullptr,               PREC_NONE},       // TOKEN_IF
+    {&Compiler::literal,    nullptr,               PREC_NONE},       // TOKEN_NIL
+    {nullptr,               &Compiler::or_,        PREC_OR},         // TOKEN_OR
+    {nullptr,               nullptr,               PREC_NONE},       // TOKEN_PRINT
+    {nullptr,               nullptr,               PREC_NONE},       // TOKEN_RETURN
+    {nullptr,               nullptr,               PREC_NONE},       // TOKEN_SUPER
+    {nullptr,               nullptr,               PREC_NONE},       // TOKEN_THIS
+    {&Compiler::literal,    nullptr,               PREC_NONE},       // TOKEN_TRUE
+    {nullptr,               nullptr,               PREC_NONE},       // TOKEN_VAR
+    {nullptr,               nullptr,               PREC_NONE},       // TOKEN_WHILE
+    {nullptr,               nullptr,               PREC_NONE},       // TOKEN_ERROR
+    {nullptr,               nullptr,               PREC_NONE},       // TOKEN_EOF
+};
+
+static_assert(sizeof(RULES) / sizeof(RULES[0]) == TOKEN_EOF + 1, "Every token needs a parse rule.");
 
-Parser::Parser(std::shared_ptr<Scanner> scanner, Compiler& compiler): 
+}
+
+Parser::Parser(std::shared_ptr<Scanner> scanner, Compiler& compiler):
 m_scanner {scanner},
 m_compiler {compiler}
 {
-    BIND_FUNC(grouping);
-    BIND_FUNC(unary);
-    BIND_FUNC(binary);
-    BIND_FUNC(number);
-    BIND_FUNC(literal);
-    BIND_FUNC(string);
-    BIND_FUNC(variable);
-    BIND_FUNC(and_);
-    BIND_FUNC(or_);
-    ParseFn NULL_FN {};
-
-    m_rules =  {
-        //[TOKEN_LEFT_PAREN] 
-        {grouping,    NULL_FN,   PREC_NONE},
-        //[TOKEN_RIGHT_PAREN]
-        {NULL_FN,     NULL_FN,   PREC_NONE},
-        //[TOKEN_LEFT_BRACE] 
-        {NULL_FN,     NULL_FN,   PREC_NONE}, 
-        //[TOKEN_RIGHT_BRACE]
-        {NULL_FN,     NULL_FN,   PREC_NONE},
-        //[TOKEN_COMMA]      
-        {NULL_FN,     NULL_FN,   PREC_NONE},
-        //[TOKEN_DOT]        
-        {NULL_FN,     NULL_FN,   PREC_NONE},
-        //[TOKEN_MINUS]      
-        {unary,       binary,    PREC_TERM},
-        //[TOKEN_PLUS]       
-        {NULL_FN,     binary,    PREC_TERM},
-        //[TOKEN_SEMICOLON]  
-        {NULL_FN,     NULL_FN,   PREC_NONE},
-        //[TOKEN_SLASH]      
-        {NULL_FN,     binary,    PREC_FACTOR},
-        //[TOKEN_STAR]       
-        {NULL_FN,     binary,    PREC_FACTOR},
-        //[TOKEN_BANG]       
-        {unary,       NULL_FN,   PREC_NONE},
-        //[TOKEN_BANG_EQUAL] 
-        {NULL_FN,     binary,    PREC_EQUALITY},
-        //[TOKEN_EQUAL]      
-        {NULL_FN,     NULL_FN,   PREC_NONE},
-        //[TOKEN_EQUAL_EQUAL]
-        {NULL_FN,     binary,    PREC_EQUALITY},
-        //[TOKEN_GREATER]    
-        {NULL_FN,     binary,    PREC_COMPARISON},
-        //[TOKEN_GREATER_EQUA
-        {NULL_FN,     binary,    PREC_COMPARISON},
-        //[TOKEN_LESS]       
-        {NULL_FN,     binary,    PREC_COMPARISON},
-        //[TOKEN_LESS_EQUAL] 
-        {NULL_FN,     binary,    PREC_COMPARISON},
-        //[TOKEN_IDENTIFIER] 
-        {variable,    NULL_FN,   PREC_NONE},
-        //[TOKEN_STRING]     
-        {string,      NULL_FN,   PREC_NONE},
-        //[TOKEN_NUMBER]     
-        {number,      NULL_FN,   PREC_NONE},
-        //[TOKEN_AND]        
-        {NULL_FN,     and_,   PREC_AND},
-        //[TOKEN_CLASS]      
-        {NULL_FN,     NULL_FN,   PREC_NONE},
-        //[TOKEN_ELSE]       
-        {NULL_FN,     NULL_FN,   PREC_NONE},
-        //[TOKEN_FALSE]      
-        {literal,     NULL_FN,   PREC_NONE},
-        //[TOKEN_FOR]        
-        {NULL_FN,     NULL_FN,   PREC_NONE},
-        //[TOKEN_FUN]        
-        {NULL_FN,     NULL_FN,   PREC_NONE},
-        //[TOKEN_IF]         
-        {NULL_FN,     NULL_FN,   PREC_NONE},
-        //[TOKEN_NIL]        
-        {literal,     NULL_FN,   PREC_NONE},
-        //[TOKEN_OR]         
-        {NULL_FN,     or_,   PREC_OR},
-        //[TOKEN_PRINT]      
-        {NULL_FN,     NULL_FN,   PREC_NONE},
-        //[TOKEN_RETURN]     
-        {NULL_FN,     NULL_FN,   PREC_NONE},
-        //[TOKEN_SUPER]      
-        {NULL_FN,     NULL_FN,   PREC_NONE},
-        //[TOKEN_THIS]       
-        {NULL_FN,     NULL_FN,   PREC_NONE},
-        //[TOKEN_TRUE]       
-        {literal,     NULL_FN,   PREC_NONE},
-        //[TOKEN_VAR]        
-        {NULL_FN,     NULL_FN,   PREC_NONE},
-        //[TOKEN_WHILE]      
-        {NULL_FN,     NULL_FN,   PREC_NONE},
-        //[TOKEN_ERROR]      
-        {NULL_FN,     NULL_FN,   PREC_NONE},
-        //[TOKEN_EOF]        
-        {NULL_FN,     NULL_FN,   PREC_NONE},
-    }; 
 }
 
 void Parser::advance() {
@@ -115,18 +68,11 @@ void Parser::advance() {
         m_current = m_scanner->scan_token();
         if (m_current.type != TOKEN_ERROR) break;
 
-        error_at_current();
+        // Error tokens carry their message instead of source text.
+        error_at_current(m_current.start);
     }
 }
 
-Token& Parser::current() {
-    return m_current;
-}
-
-Token& Parser::previous() {
-    return m_previous;
-}
-
 bool Parser::had_error() {
     return m_had_error;
 }
@@ -159,8 +105,12 @@ void Parser::synchronize() {
     }
 }
 
-void Parser::error_at_current() {
-    error_at(m_current, m_current.start);
+const ParseRule& Parser::get_rule(TokenType type) {
+    return RULES[type];
+}
+
+void Parser::error_at_current(const char* message) {
+    error_at(m_current, message);
 }
 
 void Parser::error(const char* message) {
@@ -168,6 +118,8 @@ void Parser::error(const char* message) {
 }
 
 void Parser::error_at(Token &token, const char * message) {
+    // Report only the first error until the parser resynchronizes.
+    if (m_panic_mode) return;
     m_panic_mode = true;
     fprintf(stderr, "[line %d] Error", token.line);
 
@@ -189,25 +141,25 @@ void Parser::consume(TokenType type, const char* message) {
         return;
     }
 
-    error_at_current();
+    error_at_current(message);
 }
 
 
 void Parser::parse_precedence(Precedence precedence) {
     advance();
     ParseFn prefix_rule = get_rule(m_previous.type).prefix;
-    if (!prefix_rule) {
+    if (prefix_rule == nullptr) {
         error("Expect expression");
         return;
     }
 
     bool can_assign = precedence <= PREC_ASSIGNMENT;
-    prefix_rule(can_assign);
+    (m_compiler.*prefix_rule)(can_assign);
 
     while (precedence <= get_rule(m_current.type).precedence) {
         advance();
         ParseFn infix_rule = get_rule(m_previous.type).infix;
-        infix_rule(can_assign);
+        (m_compiler.*infix_rule)(can_assign);
     }
 
     if (can_assign && m_compiler.match(TOKEN_EQUAL)) {
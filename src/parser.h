@@ -1,15 +1,15 @@
 #pragma once
 
-#include <functional>
+#include <memory>
 
 #include "common.h"
 #include "token.h"
 #include "scanner.h"
 
-using ParseFn = std::function<void(bool)>;
-
 struct Compiler;
 
+using ParseFn = void (Compiler::*)(bool can_assign);
+
 enum Precedence {
   PREC_NONE,
   PREC_ASSIGNMENT,  // =
@@ -25,28 +25,32 @@ enum Precedence {
 };
 
 struct ParseRule {
-    ParseFn prefix {};
-    ParseFn infix {};
-    Precedence precedence {};
+    ParseFn prefix;
+    ParseFn infix;
+    Precedence precedence;
 };
 
 struct Parser {
     Parser(std::shared_ptr<Scanner> scanner, Compiler &compiler);
     void advance();
     Token scan_token();
-    Token& current();
-    Token& previous();
     bool had_error();
     bool panic_mode();
     void synchronize();
-    void error_at_current();
+    void error_at_current(const char* message);
     void error(const char* message);
     void error_at(Token &token, const char * message);
     void consume(TokenType type, const char* message);
     void parse_precedence(Precedence precedence);
 
-    inline ParseRule& get_rule(TokenType type) {
-        return m_rules[type];
+    static const ParseRule& get_rule(TokenType type);
+
+    inline Token& current() {
+        return m_current;
+    }
+
+    inline Token& previous() {
+        return m_previous;
     }
 
     inline bool check(TokenType type) {
@@ -60,7 +64,4 @@ private:
     Token m_previous {};
     bool m_had_error {false};
     bool m_panic_mode {false};
-
-    std::vector<ParseRule> m_rules {};
-
 };
\ No newline at end of file
@@ -0,0 +1,286 @@
+#include <algorithm>
+
+#include "optimizer.h"
+#include "register_chunk.h"
+
+void RegisterChunk::write(const RegisterInstruction &instruction, int line) {
+    if (m_lines.empty() || m_lines.back().line != line) {
+        m_lines.push_back({static_cast<int>(m_code.size()), line});
+    }
+    m_code.push_back(instruction);
+}
+
+int RegisterChunk::get_line(int index) const {
+    auto run = std::upper_bound(m_lines.begin(), m_lines.end(), index,
+        [](int index, const LineStart &start) { return index < start.offset; });
+    if (run == m_lines.begin()) return 0;
+    return std::prev(run)->line;
+}
+
+namespace {
+
+// Concatenation pushes both operands above the frame.
+constexpr int SCRATCH_SLOTS = 2;
+
+uint16_t register_op(uint8_t op) {
+    switch (op) {
+        case OP_EQUAL: return REG_EQUAL;
+        case OP_NOT_EQUAL: return REG_NOT_EQUAL;
+        case OP_GREATER: return REG_GREATER;
+        case OP_GREATER_EQUAL: return REG_GREATER_EQUAL;
+        case OP_LESS: return REG_LESS;
+        case OP_LESS_EQUAL: return REG_LESS_EQUAL;
+        case OP_ADD:
+        case OP_ADD_LOCAL_CONSTANT: return REG_ADD;
+        case OP_SUBTRACT:
+        case OP_SUBTRACT_LOCAL_CONSTANT: return REG_SUBTRACT;
+        case OP_MULTIPLY: return REG_MULTIPLY;
+        case OP_DIVIDE: return REG_DIVIDE;
+        case OP_NOT: return REG_NOT;
+        case OP_NEGATE: return REG_NEGATE;
+        case OP_LESS_JUMP_IF_FALSE: return REG_LESS_JUMP_IF_FALSE;
+        case OP_LESS_EQUAL_JUMP_IF_FALSE: return REG_LESS_EQUAL_JUMP_IF_FALSE;
+        case OP_GREATER_JUMP_IF_FALSE: return REG_GREATER_JUMP_IF_FALSE;
+        case OP_GREATER_EQUAL_JUMP_IF_FALSE: return REG_GREATER_EQUAL_JUMP_IF_FALSE;
+        default: return REG_RETURN;
+    }
+}
+
+// Walks the stack code keeping, for every stack position, the register that
+// holds its value. A position's own register is its home; loads of locals
+// and constants leave the position pointing at the local or constant
+// register instead, and it is only copied home when something needs it
+// there: at the edges of basic blocks, or before the register it points at
+// is overwritten.
+struct Lowering {
+    Chunk &m_chunk;
+    RegisterChunk &m_out;
+    const std::vector<DecodedInstruction> &m_code;
+
+    std::vector<uint16_t> m_stack {};
+    std::vector<int> m_labels {};
+    // Register jumps paired with the stack instruction they target.
+    std::vector<std::pair<int, int>> m_fixups {};
+    // The last emitted instruction, if it wrote the top of the stack home.
+    int m_result {-1};
+    int m_line {0};
+    int m_nil {-1};
+    int m_true {-1};
+    int m_false {-1};
+    bool m_ok {true};
+
+    uint16_t constant_register(uint32_t index) {
+        if (REGISTER_CONSTANT_BASE + index > UINT16_MAX) {
+            m_ok = false;
+            return 0;
+        }
+        return REGISTER_CONSTANT_BASE + index;
+    }
+
+    uint16_t literal_register(const Value &value, int &index) {
+        if (index < 0) index = m_chunk.add_constant(value);
+        return constant_register(index);
+    }
+
+    int emit(uint16_t op, uint16_t a, uint16_t b = 0, uint16_t c = 0) {
+        m_out.write({op, a, b, c}, m_line);
+        m_result = -1;
+        return m_out.m_code.size() - 1;
+    }
+
+    void emit_jump(uint16_t op, const DecodedInstruction &instruction, uint16_t b = 0, uint16_t c = 0) {
+        m_fixups.push_back({emit(op, 0, b, c), instruction.target});
+    }
+
+    uint16_t push_home() {
+        uint16_t position = m_stack.size();
+        m_stack.push_back(position);
+        m_out.m_frame_size = std::max<int>(m_out.m_frame_size, m_stack.size());
+        return position;
+    }
+
+    void push_alias(uint16_t reg) {
+        push_home();
+        m_stack.back() = reg;
+    }
+
+    uint16_t pop() {
+        uint16_t reg = m_stack.back();
+        m_stack.pop_back();
+        return reg;
+    }
+
+    void materialize(int position) {
+        if (m_stack[position] == position) return;
+        emit(REG_MOVE, position, m_stack[position]);
+        m_stack[position] = position;
+    }
+
+    void materialize_all() {
+        for (int position = 0; position < static_cast<int>(m_stack.size()); position++) {
+            materialize(position);
+        }
+    }
+
+    bool is_aliased(uint16_t reg) const {
+        for (int position = 0; position < static_cast<int>(m_stack.size()); position++) {
+            if (position != reg && m_stack[position] == reg) return true;
+        }
+        return false;
+    }
+
+    // Saves the values that still read reg before it is overwritten.
+    void before_write(uint16_t reg) {
+        for (int position = 0; position < static_cast<int>(m_stack.size()); position++) {
+            if (position != reg && m_stack[position] == reg) materialize(position);
+        }
+    }
+
+    void binary(uint16_t op) {
+        uint16_t b = pop();
+        uint16_t a = pop();
+        uint16_t position = push_home();
+        m_result = emit(op, position, a, b);
+    }
+
+    void set_local(uint16_t slot) {
+        uint16_t top = m_stack.size() - 1;
+        if (m_result >= 0 && m_stack[top] == top && !is_aliased(slot)) {
+            // Compute the value straight into the local.
+            m_out.m_code[m_result].a = slot;
+        } else {
+            before_write(slot);
+            emit(REG_MOVE, slot, m_stack[top]);
+        }
+        m_result = -1;
+        m_stack[slot] = slot;
+        m_stack[top] = slot;
+    }
+
+    void lower(const DecodedInstruction &instruction) {
+        uint8_t op = instruction.op;
+        uint32_t operand = instruction.operand;
+        switch (op) {
+            case OP_CONSTANT:
+            case OP_CONSTANT_LONG:
+                push_alias(constant_register(operand));
+                break;
+            case OP_NIL: push_alias(literal_register(NIL_VAL, m_nil)); break;
+            case OP_TRUE: push_alias(literal_register(BOOL_VAL(true), m_true)); break;
+            case OP_FALSE: push_alias(literal_register(BOOL_VAL(false), m_false)); break;
+            case OP_POP: pop(); break;
+            case OP_GET_LOCAL:
+                materialize(operand);
+                push_alias(operand);
+                break;
+            case OP_SET_LOCAL:
+                set_local(operand);
+                break;
+            case OP_GET_GLOBAL: {
+                uint16_t position = push_home();
+                m_result = emit(REG_GET_GLOBAL, position, operand);
+                break;
+            }
+            case OP_SET_GLOBAL:
+                emit(REG_SET_GLOBAL, operand, m_stack.back());
+                break;
+            case OP_DEFINE_GLOBAL:
+                emit(REG_DEFINE_GLOBAL, operand, pop());
+                break;
+            case OP_EQUAL:
+            case OP_NOT_EQUAL:
+            case OP_GREATER:
+            case OP_GREATER_EQUAL:
+            case OP_LESS:
+            case OP_LESS_EQUAL:
+            case OP_ADD:
+            case OP_SUBTRACT:
+            case OP_MULTIPLY:
+            case OP_DIVIDE:
+                binary(register_op(op));
+                break;
+            case OP_ADD_LOCAL_CONSTANT:
+            case OP_SUBTRACT_LOCAL_CONSTANT: {
+                uint16_t slot = operand >> 8;
+                materialize(slot);
+                push_alias(slot);
+                push_alias(constant_register(operand & 0xff));
+                binary(register_op(op));
+                break;
+            }
+            case OP_NOT:
+            case OP_NEGATE: {
+                uint16_t a = pop();
+                uint16_t position = push_home();
+                m_result = emit(register_op(op), position, a);
+                break;
+            }
+            case OP_PRINT:
+                emit(REG_PRINT, pop());
+                break;
+            case OP_JUMP:
+            case OP_LOOP:
+                materialize_all();
+                emit_jump(REG_JUMP, instruction);
+                break;
+            case OP_JUMP_IF_FALSE:
+                materialize_all();
+                emit_jump(REG_JUMP_IF_FALSE, instruction, m_stack.back());
+                break;
+            case OP_POP_JUMP_IF_FALSE: {
+                uint16_t condition = pop();
+                materialize_all();
+                emit_jump(REG_JUMP_IF_FALSE, instruction, condition);
+                break;
+            }
+            case OP_LESS_JUMP_IF_FALSE:
+            case OP_LESS_EQUAL_JUMP_IF_FALSE:
+            case OP_GREATER_JUMP_IF_FALSE:
+            case OP_GREATER_EQUAL_JUMP_IF_FALSE: {
+                uint16_t b = pop();
+                uint16_t a = pop();
+                materialize_all();
+                emit_jump(register_op(op), instruction, a, b);
+                break;
+            }
+            case OP_RETURN:
+                emit(REG_RETURN, 0);
+                break;
+            default:
+                m_ok = false;
+                break;
+        }
+    }
+
+    bool run() {
+        m_labels.resize(m_code.size());
+        for (int i = 0; i < static_cast<int>(m_code.size()) && m_ok; i++) {
+            const DecodedInstruction &instruction = m_code[i];
+            m_line = instruction.line;
+            if (instruction.is_jump_target) {
+                // Every way in leaves the stack in its home registers.
+                materialize_all();
+                m_result = -1;
+            }
+            m_labels[i] = m_out.m_code.size();
+            lower(instruction);
+        }
+
+        if (!m_ok || m_out.m_code.size() > UINT16_MAX ||
+            m_out.m_frame_size + SCRATCH_SLOTS > REGISTER_CONSTANT_BASE) {
+            return false;
+        }
+        for (auto [index, target] : m_fixups) {
+            m_out.m_code[index].a = m_labels[target];
+        }
+        return true;
+    }
+};
+
+}
+
+bool lower_to_registers(Chunk &chunk, RegisterChunk &out, int start) {
+    std::vector<DecodedInstruction> code = decode_chunk(chunk, start);
+    Lowering lowering {chunk, out, code};
+    return lowering.run();
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <vector>
+
+#include "chunk.h"
+
+// Register operands below this name the stack slots the stack engine would
+// use, so locals keep their slot numbers. Operands from here up name the
+// chunk's constants, which the VM copies in right behind the slots.
+#define REGISTER_CONSTANT_BASE 256
+
+enum Backend {
+    BACKEND_STACK,
+    BACKEND_REGISTER,
+};
+
+// Three-address instructions over registers. a is the destination, or the
+// jump target for jumps; b and c are the operands.
+enum RegisterOpCode : uint16_t {
+    REG_MOVE,              // a = b
+    REG_GET_GLOBAL,        // a = global b
+    REG_SET_GLOBAL,        // global a = b
+    REG_DEFINE_GLOBAL,     // global a = b
+
+    REG_EQUAL,             // a = b == c
+    REG_NOT_EQUAL,
+    REG_GREATER,
+    REG_GREATER_EQUAL,
+    REG_LESS,
+    REG_LESS_EQUAL,
+    REG_ADD,               // a = b + c
+    REG_SUBTRACT,
+    REG_MULTIPLY,
+    REG_DIVIDE,
+    REG_NOT,               // a = !b
+    REG_NEGATE,            // a = -b
+
+    REG_PRINT,             // print a
+    REG_JUMP,              // goto a
+    REG_JUMP_IF_FALSE,     // if b is falsey goto a
+    REG_LESS_JUMP_IF_FALSE,          // unless b < c goto a
+    REG_LESS_EQUAL_JUMP_IF_FALSE,
+    REG_GREATER_JUMP_IF_FALSE,
+    REG_GREATER_EQUAL_JUMP_IF_FALSE,
+    REG_RETURN,
+};
+
+struct RegisterInstruction {
+    uint16_t op;
+    uint16_t a;
+    uint16_t b;
+    uint16_t c;
+};
+
+struct RegisterChunk {
+    std::vector<RegisterInstruction> m_code {};
+    // Run-length line table over instruction indices, as in Chunk.
+    std::vector<LineStart> m_lines {};
+    // Registers below this may hold live values and are GC roots.
+    int m_frame_size {0};
+
+    void write(const RegisterInstruction &instruction, int line);
+    int get_line(int index) const;
+};
+
+// Translates the stack bytecode in chunk into register code. Loads of locals
+// and constants are folded into the operands of the instructions that use
+// them, and an assignment to a local writes the result straight into the
+// local's register. Returns false if the chunk does not fit the register
+// encoding, in which case it has to run on the stack engine. Literal nil,
+// true and false may be added to chunk's constants. Only the code from offset
+// start on is lowered.
+bool lower_to_registers(Chunk &chunk, RegisterChunk &out, int start = 0);
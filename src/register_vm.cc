@@ -0,0 +1,186 @@
+#include <algorithm>
+#include <iostream>
+
+#include "vm.h"
+#include "objects/objrope.h"
+#include "objects/objstring.h"
+
+template <bool Sampled>
+InterpretResult VM::run_registers() {
+    const RegisterChunk &chunk = *m_register_chunk;
+    const ValueArray &constants = m_chunk->constants();
+
+    // Lay the constants out behind the registers so every operand is a plain
+    // index. The frame sits on the stack, so the collector marks it as usual.
+    m_stack.resize(REGISTER_CONSTANT_BASE + constants.size());
+    std::copy(constants.begin(), constants.end(), m_stack.begin() + REGISTER_CONSTANT_BASE);
+    Value* registers = m_stack.data();
+    std::fill(registers, registers + chunk.m_frame_size, NIL_VAL);
+    m_stack_top = registers + chunk.m_frame_size;
+
+    const RegisterInstruction* code = chunk.m_code.data();
+    const RegisterInstruction* pc = code;
+    const RegisterInstruction* instruction;
+    if constexpr (Sampled) {
+        m_sample_code = code;
+        m_sample_backend = BACKEND_REGISTER;
+    }
+
+#define R(operand) registers[instruction->operand]
+#define NEXT_INSTRUCTION() \
+    (instruction = pc++, Sampled ? (m_sample_ip = instruction, void()) : void(), instruction)
+#define RUNTIME_ERROR(...) \
+    do { \
+        runtime_error_at(chunk.get_line(instruction - code), __VA_ARGS__); \
+        return INTERPRET_RUNTIME_ERROR; \
+    } while (false)
+#define NUMBER_OPERANDS() \
+    do { \
+        if (!IS_NUMBER(R(b)) || !IS_NUMBER(R(c))) { \
+            RUNTIME_ERROR("Operands must be numbers."); \
+        } \
+    } while (false)
+#define BINARY_OP(value_type, op) \
+    do { \
+        NUMBER_OPERANDS(); \
+        R(a) = value_type(AS_NUMBER(R(b)) op AS_NUMBER(R(c))); \
+    } while (false)
+// As in run(), <= and >= are !(x > y) and !(x < y).
+#define COMPARE_JUMP_IF_FALSE(condition) \
+    do { \
+        NUMBER_OPERANDS(); \
+        double x = AS_NUMBER(R(b)); \
+        double y = AS_NUMBER(R(c)); \
+        if (!(condition)) pc = code + instruction->a; \
+    } while (false)
+
+#ifdef COMPUTED_GOTO
+    static const void* dispatch_table[] = {
+        &&reg_REG_MOVE,
+        &&reg_REG_GET_GLOBAL,
+        &&reg_REG_SET_GLOBAL,
+        &&reg_REG_DEFINE_GLOBAL,
+        &&reg_REG_EQUAL,
+        &&reg_REG_NOT_EQUAL,
+        &&reg_REG_GREATER,
+        &&reg_REG_GREATER_EQUAL,
+        &&reg_REG_LESS,
+        &&reg_REG_LESS_EQUAL,
+        &&reg_REG_ADD,
+        &&reg_REG_SUBTRACT,
+        &&reg_REG_MULTIPLY,
+        &&reg_REG_DIVIDE,
+        &&reg_REG_NOT,
+        &&reg_REG_NEGATE,
+        &&reg_REG_PRINT,
+        &&reg_REG_JUMP,
+        &&reg_REG_JUMP_IF_FALSE,
+        &&reg_REG_LESS_JUMP_IF_FALSE,
+        &&reg_REG_LESS_EQUAL_JUMP_IF_FALSE,
+        &&reg_REG_GREATER_JUMP_IF_FALSE,
+        &&reg_REG_GREATER_EQUAL_JUMP_IF_FALSE,
+        &&reg_REG_RETURN,
+    };
+    static_assert(sizeof(dispatch_table) / sizeof(dispatch_table[0]) == REG_RETURN + 1);
+
+#define VM_DISPATCH() \
+    do { \
+        goto *dispatch_table[NEXT_INSTRUCTION()->op]; \
+    } while (false)
+#define VM_LOOP     VM_DISPATCH();
+#define VM_CASE(op) reg_##op:
+#define VM_NEXT()   VM_DISPATCH()
+#else
+#define VM_LOOP     for (;;) switch (NEXT_INSTRUCTION()->op)
+#define VM_CASE(op) case op:
+#define VM_NEXT()   break
+#endif
+
+    VM_LOOP {
+        VM_CASE(REG_MOVE)          R(a) = R(b); VM_NEXT();
+        VM_CASE(REG_GET_GLOBAL) {
+            const Value &value = m_global_values[instruction->b];
+            if (IS_UNDEFINED(value)) {
+                RUNTIME_ERROR("Undefined variable '%s'.", m_global_names[instruction->b]->chars());
+            }
+            R(a) = value;
+            VM_NEXT();
+        }
+        VM_CASE(REG_SET_GLOBAL) {
+            if (IS_UNDEFINED(m_global_values[instruction->a])) {
+                RUNTIME_ERROR("Undefined variable '%s'.", m_global_names[instruction->a]->chars());
+            }
+            m_global_values[instruction->a] = R(b);
+            VM_NEXT();
+        }
+        VM_CASE(REG_DEFINE_GLOBAL)
+            m_global_values[instruction->a] = R(b);
+            VM_NEXT();
+        VM_CASE(REG_EQUAL)         R(a) = BOOL_VAL(R(b) == R(c)); VM_NEXT();
+        VM_CASE(REG_NOT_EQUAL)     R(a) = BOOL_VAL(!(R(b) == R(c))); VM_NEXT();
+        VM_CASE(REG_GREATER)       BINARY_OP(BOOL_VAL, >); VM_NEXT();
+        VM_CASE(REG_LESS)          BINARY_OP(BOOL_VAL, <); VM_NEXT();
+        VM_CASE(REG_GREATER_EQUAL)
+            NUMBER_OPERANDS();
+            R(a) = BOOL_VAL(!(AS_NUMBER(R(b)) < AS_NUMBER(R(c))));
+            VM_NEXT();
+        VM_CASE(REG_LESS_EQUAL)
+            NUMBER_OPERANDS();
+            R(a) = BOOL_VAL(!(AS_NUMBER(R(b)) > AS_NUMBER(R(c))));
+            VM_NEXT();
+        VM_CASE(REG_ADD) {
+            if (IS_NUMBER(R(b)) && IS_NUMBER(R(c))) {
+                R(a) = NUMBER_VAL(AS_NUMBER(R(b)) + AS_NUMBER(R(c)));
+            } else if (IS_TEXT(R(b)) && IS_TEXT(R(c))) {
+                // concatenate() works on the stack, which is free above the frame.
+                push(R(b));
+                push(R(c));
+                if (!concatenate()) {
+                    RUNTIME_ERROR("String too long.");
+                }
+                R(a) = pop();
+            } else {
+                RUNTIME_ERROR("Operands must be two numbers or two strings.");
+            }
+            VM_NEXT();
+        }
+        VM_CASE(REG_SUBTRACT)      BINARY_OP(NUMBER_VAL, -); VM_NEXT();
+        VM_CASE(REG_MULTIPLY)      BINARY_OP(NUMBER_VAL, *); VM_NEXT();
+        VM_CASE(REG_DIVIDE)        BINARY_OP(NUMBER_VAL, /); VM_NEXT();
+        VM_CASE(REG_NOT)           R(a) = BOOL_VAL(R(b).is_falsey()); VM_NEXT();
+        VM_CASE(REG_NEGATE)
+            if (!IS_NUMBER(R(b))) {
+                RUNTIME_ERROR("Operand must be a number.");
+            }
+            R(a) = NUMBER_VAL(-AS_NUMBER(R(b)));
+            VM_NEXT();
+        VM_CASE(REG_PRINT)
+            print_value(R(a), m_output);
+            m_output.put('\n');
+            VM_NEXT();
+        VM_CASE(REG_JUMP)          pc = code + instruction->a; VM_NEXT();
+        VM_CASE(REG_JUMP_IF_FALSE)
+            if (R(b).is_falsey()) pc = code + instruction->a;
+            VM_NEXT();
+        VM_CASE(REG_LESS_JUMP_IF_FALSE)          COMPARE_JUMP_IF_FALSE(x < y); VM_NEXT();
+        VM_CASE(REG_LESS_EQUAL_JUMP_IF_FALSE)    COMPARE_JUMP_IF_FALSE(!(x > y)); VM_NEXT();
+        VM_CASE(REG_GREATER_JUMP_IF_FALSE)       COMPARE_JUMP_IF_FALSE(x > y); VM_NEXT();
+        VM_CASE(REG_GREATER_EQUAL_JUMP_IF_FALSE) COMPARE_JUMP_IF_FALSE(!(x < y)); VM_NEXT();
+        VM_CASE(REG_RETURN)
+            reset_stack();
+            return INTERPRET_OK;
+    }
+#undef R
+#undef NEXT_INSTRUCTION
+#undef RUNTIME_ERROR
+#undef NUMBER_OPERANDS
+#undef BINARY_OP
+#undef COMPARE_JUMP_IF_FALSE
+#undef VM_DISPATCH
+#undef VM_LOOP
+#undef VM_CASE
+#undef VM_NEXT
+}
+
+template InterpretResult VM::run_registers<false>();
+template InterpretResult VM::run_registers<true>();
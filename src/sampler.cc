@@ -0,0 +1,111 @@
+#include <errno.h>
+#include <signal.h>
+#include <sys/time.h>
+
+#include <iostream>
+
+#include "sampler.h"
+#include "chunk.h"
+#include "register_chunk.h"
+#include "vm.h"
+
+extern VM vm;
+
+namespace {
+
+// A sample is an offset into the stack engine's code, or an instruction index
+// with REGISTER_SAMPLE set for the register engine.
+constexpr uint32_t REGISTER_SAMPLE = 1u << 31;
+constexpr uint32_t NOT_RUNNING = UINT32_MAX;
+
+// The handler is the only producer and drain() the only consumer, and both
+// run on the main thread, so the ring needs no lock: the handler publishes an
+// entry by moving the head, drain() frees it by moving the tail.
+uint32_t s_ring[SAMPLER_RING_SIZE];
+std::atomic<uint32_t> s_head {0};
+std::atomic<uint32_t> s_tail {0};
+std::atomic<uint64_t> s_dropped {0};
+
+uint32_t current_sample() {
+    const void* ip = vm.m_sample_ip;
+    if (ip == nullptr) return NOT_RUNNING;
+    const void* code = vm.m_sample_code;
+    if (vm.m_sample_backend == BACKEND_REGISTER) {
+        auto index = static_cast<const RegisterInstruction*>(ip) - static_cast<const RegisterInstruction*>(code);
+        return REGISTER_SAMPLE | static_cast<uint32_t>(index);
+    }
+    return static_cast<const uint8_t*>(ip) - static_cast<const uint8_t*>(code);
+}
+
+void on_sigprof(int) {
+    int saved_errno = errno;
+    uint32_t head = s_head.load(std::memory_order_relaxed);
+    if (head - s_tail.load(std::memory_order_acquire) == SAMPLER_RING_SIZE) {
+        s_dropped.fetch_add(1, std::memory_order_relaxed);
+    } else {
+        s_ring[head % SAMPLER_RING_SIZE] = current_sample();
+        s_head.store(head + 1, std::memory_order_release);
+    }
+    errno = saved_errno;
+}
+
+bool set_timer(int hz) {
+    itimerval timer {};
+    if (hz > 0) {
+        timer.it_interval.tv_sec = 1 / hz;
+        timer.it_interval.tv_usec = (1000000 / hz) % 1000000;
+        timer.it_value = timer.it_interval;
+    }
+    return setitimer(ITIMER_PROF, &timer, nullptr) == 0;
+}
+
+}
+
+bool Sampler::start(int hz) {
+    if (hz <= 0 || hz > 1000000) return false;
+
+    struct sigaction action {};
+    action.sa_handler = on_sigprof;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    if (sigaction(SIGPROF, &action, nullptr) < 0) return false;
+    return set_timer(hz);
+}
+
+void Sampler::stop() {
+    set_timer(0);
+}
+
+void Sampler::drain(const Chunk* chunk, const RegisterChunk* registers) {
+    uint32_t head = s_head.load(std::memory_order_acquire);
+    uint32_t tail = s_tail.load(std::memory_order_relaxed);
+    for (; tail != head; tail++) {
+        uint32_t sample = s_ring[tail % SAMPLER_RING_SIZE];
+        int line = 0;
+        if (sample == NOT_RUNNING) {
+            line = 0;
+        } else if (sample & REGISTER_SAMPLE) {
+            if (registers != nullptr) line = registers->get_line(sample & ~REGISTER_SAMPLE);
+        } else if (chunk != nullptr) {
+            line = chunk->get_line(sample);
+        }
+        m_lines[line]++;
+    }
+    s_tail.store(tail, std::memory_order_release);
+}
+
+void Sampler::write_collapsed(std::ostream &out, const std::string &script) const {
+    for (auto [line, count] : m_lines) {
+        out << script << ";";
+        if (line == 0) {
+            out << "(not running)";
+        } else {
+            out << "line " << line;
+        }
+        out << " " << count << "\n";
+    }
+}
+
+uint64_t Sampler::dropped() const {
+    return s_dropped.load(std::memory_order_relaxed);
+}
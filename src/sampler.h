@@ -0,0 +1,45 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <iosfwd>
+#include <map>
+#include <string>
+
+struct Chunk;
+struct RegisterChunk;
+
+// Size of the ring the signal handler writes samples into. At the default
+// rate it holds about a minute of samples between drains.
+#define SAMPLER_RING_SIZE (1 << 16)
+// Most of what sampling costs is the sampled loops publishing every
+// instruction, not the signals, so a lower rate would buy little.
+#define SAMPLER_DEFAULT_HZ 1000
+
+// Statistical profiler over Lox source lines. A SIGPROF timer interrupts the
+// process, and the handler copies the instruction VM::m_sample_ip points at
+// into a single-producer ring without locking or allocating. The VM drains
+// the ring after every run, while the chunks the offsets refer to are still
+// current, and the totals are written as collapsed stacks for flamegraph
+// tools.
+struct Sampler {
+    // Starts sampling hz times per second of CPU time. Only one sampler can
+    // run at a time.
+    bool start(int hz);
+    void stop();
+
+    // Charges the samples taken so far to source lines, looking stack engine
+    // offsets up in chunk and register engine indices in registers.
+    void drain(const Chunk* chunk, const RegisterChunk* registers);
+
+    // One "script;line N count" line per sampled line, plus samples taken
+    // outside the interpreter loops (compiling, startup) as
+    // "script;(not running) count".
+    void write_collapsed(std::ostream &out, const std::string &script) const;
+
+    uint64_t dropped() const;
+
+private:
+    // Samples per source line; 0 collects those taken outside the loops.
+    std::map<int, uint64_t> m_lines {};
+};
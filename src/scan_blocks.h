@@ -0,0 +1,157 @@
+#pragma once
+
+#include <bit>
+#include <cstdint>
+
+// Bulk character scanning for the Scanner. Each function skips a run of one
+// class of characters starting at p and returns the first byte that ends it,
+// or end. With SCANNER_SIMD the source is classified a whole block at a time
+// (32 bytes with AVX2, 16 with SSE2) into one bit per byte; the last partial
+// block, and builds without SIMD, take the scalar loop.
+
+#if defined(SCANNER_SIMD) && defined(__AVX2__)
+#include <immintrin.h>
+
+#define SCAN_BLOCK 32
+typedef __m256i ScanVector;
+
+static inline ScanVector scan_load(const char* p) {
+    return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+}
+static inline uint32_t scan_equal(ScanVector v, char c) {
+    return _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(c)));
+}
+// Bytes in [low, high]: shifting the range down to start at -128 turns the
+// unsigned range check into one signed compare.
+static inline uint32_t scan_range(ScanVector v, char low, char high) {
+    __m256i shifted = _mm256_add_epi8(v, _mm256_set1_epi8(static_cast<char>(-128 - low)));
+    __m256i limit = _mm256_set1_epi8(static_cast<char>(high - low - 127));
+    return _mm256_movemask_epi8(_mm256_cmpgt_epi8(limit, shifted));
+}
+static inline ScanVector scan_fold_case(ScanVector v) {
+    return _mm256_or_si256(v, _mm256_set1_epi8(0x20));
+}
+#elif defined(SCANNER_SIMD) && defined(__SSE2__)
+#include <emmintrin.h>
+
+#define SCAN_BLOCK 16
+typedef __m128i ScanVector;
+
+static inline ScanVector scan_load(const char* p) {
+    return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+}
+static inline uint32_t scan_equal(ScanVector v, char c) {
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8(c)));
+}
+static inline uint32_t scan_range(ScanVector v, char low, char high) {
+    __m128i shifted = _mm_add_epi8(v, _mm_set1_epi8(static_cast<char>(-128 - low)));
+    __m128i limit = _mm_set1_epi8(static_cast<char>(high - low - 127));
+    return _mm_movemask_epi8(_mm_cmpgt_epi8(limit, shifted));
+}
+static inline ScanVector scan_fold_case(ScanVector v) {
+    return _mm_or_si128(v, _mm_set1_epi8(0x20));
+}
+#endif
+
+#ifdef SCAN_BLOCK
+#define SCAN_BLOCK_MASK (SCAN_BLOCK == 32 ? 0xffffffffu : 0xffffu)
+// Most names and numbers are a few characters long, which a byte loop gets
+// through faster than a block compare, so blocks start after this many.
+#define SCAN_LEAD 8
+
+// Bits below the first set bit of stop.
+static inline uint32_t scan_before(uint32_t stop) {
+    return (1u << std::countr_zero(stop)) - 1;
+}
+#endif
+
+// Where the byte-at-a-time lead-in of a run stops.
+static inline const char* scan_lead_end(const char* p, const char* end) {
+#ifdef SCAN_BLOCK
+    if (end - p > SCAN_LEAD) return p + SCAN_LEAD;
+#endif
+    return end;
+}
+
+static inline bool scan_is_digit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+static inline bool scan_is_identifier(char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_' || scan_is_digit(c);
+}
+
+// Finds the newline that ends a comment.
+static inline const char* scan_to_newline(const char* p, const char* end) {
+    for (const char* lead = scan_lead_end(p, end); p < lead; p++) {
+        if (*p == '\n') return p;
+    }
+#ifdef SCAN_BLOCK
+    while (end - p >= SCAN_BLOCK) {
+        uint32_t stop = scan_equal(scan_load(p), '\n');
+        if (stop != 0) return p + std::countr_zero(stop);
+        p += SCAN_BLOCK;
+    }
+#endif
+    while (p < end && *p != '\n') p++;
+    return p;
+}
+
+// Finds the closing quote of a string, counting the newlines inside it.
+static inline const char* scan_to_quote(const char* p, const char* end, int &line) {
+    for (const char* lead = scan_lead_end(p, end); p < lead; p++) {
+        if (*p == '"') return p;
+        if (*p == '\n') line++;
+    }
+#ifdef SCAN_BLOCK
+    while (end - p >= SCAN_BLOCK) {
+        ScanVector block = scan_load(p);
+        uint32_t newlines = scan_equal(block, '\n');
+        uint32_t stop = scan_equal(block, '"');
+        if (stop != 0) {
+            line += std::popcount(newlines & scan_before(stop));
+            return p + std::countr_zero(stop);
+        }
+        line += std::popcount(newlines);
+        p += SCAN_BLOCK;
+    }
+#endif
+    for (; p < end && *p != '"'; p++) {
+        if (*p == '\n') line++;
+    }
+    return p;
+}
+
+// Skips letters, digits and underscores.
+static inline const char* scan_identifier(const char* p, const char* end) {
+    for (const char* lead = scan_lead_end(p, end); p < lead; p++) {
+        if (!scan_is_identifier(*p)) return p;
+    }
+#ifdef SCAN_BLOCK
+    while (end - p >= SCAN_BLOCK) {
+        ScanVector block = scan_load(p);
+        uint32_t word = scan_range(scan_fold_case(block), 'a', 'z') | scan_range(block, '0', '9') |
+                        scan_equal(block, '_');
+        uint32_t stop = ~word & SCAN_BLOCK_MASK;
+        if (stop != 0) return p + std::countr_zero(stop);
+        p += SCAN_BLOCK;
+    }
+#endif
+    while (p < end && scan_is_identifier(*p)) p++;
+    return p;
+}
+
+static inline const char* scan_digits(const char* p, const char* end) {
+    for (const char* lead = scan_lead_end(p, end); p < lead; p++) {
+        if (!scan_is_digit(*p)) return p;
+    }
+#ifdef SCAN_BLOCK
+    while (end - p >= SCAN_BLOCK) {
+        uint32_t stop = ~scan_range(scan_load(p), '0', '9') & SCAN_BLOCK_MASK;
+        if (stop != 0) return p + std::countr_zero(stop);
+        p += SCAN_BLOCK;
+    }
+#endif
+    while (p < end && scan_is_digit(*p)) p++;
+    return p;
+}
@@ -2,13 +2,75 @@
 #include <stdio.h>
 #include <string.h>
 
+#include <array>
+
 #include "common.h"
+#include "scan_blocks.h"
 #include "scanner.h"
 #include "token.h"
 
-Scanner::Scanner(const std::string &source):
+namespace {
+
+struct Keyword {
+    const char* text;
+    int length;
+    TokenType type;
+};
+
+constexpr Keyword KEYWORDS[] = {
+    {"and", 3, TOKEN_AND},
+    {"class", 5, TOKEN_CLASS},
+    {"else", 4, TOKEN_ELSE},
+    {"false", 5, TOKEN_FALSE},
+    {"for", 3, TOKEN_FOR},
+    {"fun", 3, TOKEN_FUN},
+    {"if", 2, TOKEN_IF},
+    {"nil", 3, TOKEN_NIL},
+    {"or", 2, TOKEN_OR},
+    {"print", 5, TOKEN_PRINT},
+    {"return", 6, TOKEN_RETURN},
+    {"super", 5, TOKEN_SUPER},
+    {"this", 4, TOKEN_THIS},
+    {"true", 4, TOKEN_TRUE},
+    {"var", 3, TOKEN_VAR},
+    {"while", 5, TOKEN_WHILE},
+};
+
+#define KEYWORD_MIN_LENGTH 2
+#define KEYWORD_MAX_LENGTH 6
+#define KEYWORD_TABLE_SIZE 32
+
+// The second character and the length are enough to tell every keyword
+// apart, so an identifier needs one probe and one memcmp.
+constexpr unsigned keyword_hash(char second, int length) {
+    return ((unsigned char)second + 8u * length) & (KEYWORD_TABLE_SIZE - 1);
+}
+
+constexpr std::array<Keyword, KEYWORD_TABLE_SIZE> make_keyword_table() {
+    std::array<Keyword, KEYWORD_TABLE_SIZE> table {};
+    for (const Keyword &keyword : KEYWORDS) {
+        table[keyword_hash(keyword.text[1], keyword.length)] = keyword;
+    }
+    return table;
+}
+
+constexpr std::array<Keyword, KEYWORD_TABLE_SIZE> KEYWORD_TABLE = make_keyword_table();
+
+constexpr bool keyword_hash_is_perfect() {
+    for (const Keyword &keyword : KEYWORDS) {
+        if (KEYWORD_TABLE[keyword_hash(keyword.text[1], keyword.length)].type != keyword.type) return false;
+    }
+    return true;
+}
+
+static_assert(keyword_hash_is_perfect(), "Two keywords share a slot; change keyword_hash.");
+
+}
+
+Scanner::Scanner(std::string_view source):
 m_source {source} {
-    m_start = m_source.c_str();
+    m_start = m_source.data();
+    m_end = m_start + m_source.size();
     m_current = m_start;
     m_line = 1;
 }
@@ -56,7 +118,7 @@ Token Scanner::scan_token() {
 }
 
 bool Scanner::is_at_end() const {
-    return *m_current == '\0';
+    return m_current >= m_end;
 }
 
 Token Scanner::make_token(TokenType type) const {
@@ -68,22 +130,24 @@ Token Scanner::make_token(TokenType type) const {
     return token;
 }
 
-Token Scanner::error_token(const std::string &message) const {
+Token Scanner::error_token(const char* message) const {
     Token token;
     token.type = TOKEN_ERROR;
-    token.start = message.c_str();
-    token.length = message.length();
+    token.start = message;
+    token.length = (int)strlen(message);
     token.line = m_line;
     return token;
 }
 
 bool Scanner::match(char expected) {
-    if (is_at_end()) return false;
-    if (*m_current != expected) return false;
+    if (peek() != expected) return false;
     m_current++;
     return true;
 }
 
+// Whitespace between tokens is mostly a single space or a short indent,
+// which a byte at a time gets through faster than scan_blocks.h can set up a
+// block. Comments are long enough to pay for it.
 void Scanner::skip_whitespace() {
     for (;;) {
         char c = peek();
@@ -98,11 +162,8 @@ void Scanner::skip_whitespace() {
                 advance();
                 break;
             case '/':
-                if (peek_next() == '/') {
-                    while (peek() != '\n' && !is_at_end()) advance();
-                } else {
-                    return;
-                }
+                if (peek_next() != '/') return;
+                m_current = scan_to_newline(m_current + 2, m_end);
                 break;
             default:
                 return;
@@ -111,10 +172,7 @@ void Scanner::skip_whitespace() {
 }
 
 Token Scanner::string() {
-    while (peek() != '"' && !is_at_end()) {
-        if (peek() == '\n') m_line++;
-        advance();
-    }
+    m_current = scan_to_quote(m_current, m_end, m_line);
 
     if (is_at_end()) return error_token("Unterminated string");
 
@@ -123,63 +181,29 @@ Token Scanner::string() {
 }
 
 Token Scanner::number() {
-    while (is_digit(peek())) advance();
+    m_current = scan_digits(m_current, m_end);
 
     // Look for a fractional part
     if (peek() == '.' && is_digit(peek_next())) {
-        // Consume the '.'
-        advance();
-
-        while (is_digit(peek())) advance();
+        // Skip the '.' along with the digits after it
+        m_current = scan_digits(m_current + 1, m_end);
     }
 
     return make_token(TOKEN_NUMBER);
 }
 
 Token Scanner::identifier() {
-    while (is_alpha(peek()) || is_digit(peek())) advance();
+    m_current = scan_identifier(m_current, m_end);
     return make_token(identifier_type());
 }
 
 TokenType Scanner::identifier_type() const {
-    switch (m_start[0]) {
-        case 'a': return check_keyword(1, 2, "nd", TOKEN_AND);
-        case 'c': return check_keyword(1, 4, "lass", TOKEN_CLASS);
-        case 'e': return check_keyword(1, 3, "lse", TOKEN_ELSE);
-        case 'f':
-            if (m_current - m_start > 1) {
-                switch (m_start[1]) {
-                case 'a': return check_keyword(2, 3, "lse", TOKEN_FALSE);
-                case 'o': return check_keyword(2, 1, "r", TOKEN_FOR);
-                case 'u': return check_keyword(2, 1, "n", TOKEN_FUN);
-                }
-            }
-            break;
-        case 'i': return check_keyword(1, 1, "f", TOKEN_IF);
-        case 'n': return check_keyword(1, 2, "il", TOKEN_NIL);
-        case 'o': return check_keyword(1, 1, "r", TOKEN_OR);
-        case 'p': return check_keyword(1, 4, "rint", TOKEN_PRINT);
-        case 'r': return check_keyword(1, 5, "eturn", TOKEN_RETURN);
-        case 's': return check_keyword(1, 4, "uper", TOKEN_SUPER);
-        case 't':
-            if (m_current - m_start > 1) {
-                switch (m_start[1]) {
-                case 'h': return check_keyword(2, 2, "is", TOKEN_THIS);
-                case 'r': return check_keyword(2, 2, "ue", TOKEN_TRUE);
-                }
-            }
-            break;
-        case 'v': return check_keyword(1, 2, "ar", TOKEN_VAR);
-        case 'w': return check_keyword(1, 4, "hile", TOKEN_WHILE);
-    }
-
-    return TOKEN_IDENTIFIER;
-}
+    int length = (int)(m_current - m_start);
+    if (length < KEYWORD_MIN_LENGTH || length > KEYWORD_MAX_LENGTH) return TOKEN_IDENTIFIER;
 
-TokenType Scanner::check_keyword(int start, int length, const char* rest, TokenType type) const {
-    if (m_current - m_start == start + length &&
-        memcmp(m_start + start, rest, length) == 0) {
-        return type;
+    const Keyword &keyword = KEYWORD_TABLE[keyword_hash(m_start[1], length)];
+    if (keyword.length == length && memcmp(m_start, keyword.text, length) == 0) {
+        return keyword.type;
     }
 
     return TOKEN_IDENTIFIER;
@@ -1,31 +1,35 @@
 #pragma once
 
+#include <string_view>
+
 #include "common.h"
 #include "token.h"
 
 struct Scanner {
-    Scanner(const std::string &source);
+    // source need not be null-terminated; it may point into a mapped file.
+    Scanner(std::string_view source);
     Token scan_token();
     bool is_at_end() const;
     Token make_token(TokenType type) const;
-    Token error_token(const std::string &message) const;
+    Token error_token(const char* message) const;
     bool match(char expected);
     void skip_whitespace();
     Token string();
     Token number();
     Token identifier();
     TokenType identifier_type() const;
-    TokenType check_keyword(int start, int length, const char* rest, TokenType type) const;
 
     inline char advance() {
         m_current++;
         return m_current[-1];
     }
+    // Both read as '\0' past the end of the source.
     inline char peek() const {
+        if (is_at_end()) return '\0';
         return *m_current;
     }
     inline char peek_next() const {
-        if (is_at_end()) return '\0';
+        if (m_end - m_current < 2) return '\0';
         return m_current[1];
     }
     static inline bool is_digit(char c) {
@@ -37,7 +41,8 @@ struct Scanner {
                 c == '_';
     }
 
-    const std::string &m_source;
+    std::string_view m_source;
+    const char* m_end {nullptr};
     const char* m_start {nullptr};
     const char* m_current {nullptr};
     int m_line {0}; 
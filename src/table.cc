@@ -0,0 +1,129 @@
+#include <string.h>
+
+#include "table.h"
+#include "memory.h"
+#include "objects/objstring.h"
+
+bool Table::get(ObjString* key, Value &value) {
+    if (m_count == 0) return false;
+
+    Entry* entry = find_entry(key);
+    if (entry->key == nullptr) return false;
+
+    value = entry->value;
+    return true;
+}
+
+bool Table::set(ObjString* key, const Value &value) {
+    if (m_count + 1 > capacity() * TABLE_MAX_LOAD) {
+        adjust_capacity(GROW_CAPACITY(capacity()));
+    }
+
+    Entry* entry = find_entry(key);
+    bool is_new_key = entry->key == nullptr;
+    // Reusing a tombstone does not change the count.
+    if (is_new_key && IS_NIL(entry->value)) m_count++;
+
+    entry->key = key;
+    entry->value = value;
+    return is_new_key;
+}
+
+bool Table::remove(ObjString* key) {
+    if (m_count == 0) return false;
+
+    Entry* entry = find_entry(key);
+    if (entry->key == nullptr) return false;
+
+    // Place a tombstone in the entry.
+    entry->key = nullptr;
+    entry->value = BOOL_VAL(true);
+    return true;
+}
+
+void Table::add_all(const Table &from) {
+    for (const Entry &entry : from.m_entries) {
+        if (entry.key != nullptr) {
+            set(entry.key, entry.value);
+        }
+    }
+}
+
+ObjString* Table::find_string(const char* chars, size_t length, uint32_t hash) const {
+    if (m_count == 0) return nullptr;
+
+    uint32_t index = hash & (capacity() - 1);
+    for (;;) {
+        const Entry &entry = m_entries[index];
+        if (entry.key == nullptr) {
+            // Stop if we find an empty non-tombstone entry.
+            if (IS_NIL(entry.value)) return nullptr;
+        } else if (entry.key->m_hash == hash &&
+                   entry.key->m_length == length &&
+                   memcmp(entry.key->chars(), chars, length) == 0) {
+            return entry.key;
+        }
+
+        index = (index + 1) & (capacity() - 1);
+    }
+}
+
+void Table::mark() const {
+    for (const Entry &entry : m_entries) {
+        mark_object(entry.key);
+        mark_value(entry.value);
+    }
+}
+
+void Table::remove_white() {
+    for (Entry &entry : m_entries) {
+        if (entry.key != nullptr && !entry.key->m_is_marked) {
+            remove(entry.key);
+        }
+    }
+}
+
+int Table::count() const {
+    return m_count;
+}
+
+int Table::capacity() const {
+    return m_entries.size();
+}
+
+Entry* Table::find_entry(ObjString* key) {
+    uint32_t index = key->m_hash & (capacity() - 1);
+    Entry* tombstone = nullptr;
+
+    for (;;) {
+        Entry* entry = &m_entries[index];
+        if (entry->key == nullptr) {
+            if (IS_NIL(entry->value)) {
+                // Empty entry, hand back an earlier tombstone if we passed one.
+                return tombstone != nullptr ? tombstone : entry;
+            } else {
+                if (tombstone == nullptr) tombstone = entry;
+            }
+        } else if (entry->key == key) {
+            return entry;
+        }
+
+        index = (index + 1) & (capacity() - 1);
+    }
+}
+
+void Table::adjust_capacity(int capacity) {
+    std::vector<Entry> old_entries {std::move(m_entries)};
+    m_entries = std::vector<Entry>(capacity);
+
+    // Tombstones are dropped while rehashing.
+    m_count = 0;
+    for (const Entry &entry : old_entries) {
+        if (entry.key == nullptr) continue;
+
+        Entry* dest = find_entry(entry.key);
+        dest->key = entry.key;
+        dest->value = entry.value;
+        m_count++;
+    }
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include "common.h"
+#include "value.h"
+
+struct ObjString;
+
+#define TABLE_MAX_LOAD 0.75
+
+struct Entry {
+    ObjString* key {nullptr};
+    Value value {};
+};
+
+// Open-addressing hash table keyed by interned strings. Collisions are
+// resolved with linear probing and deleted entries leave a tombstone (a
+// null key with a true value) so that later probe sequences stay intact.
+struct Table {
+    bool get(ObjString* key, Value &value);
+    bool set(ObjString* key, const Value &value);
+    bool remove(ObjString* key);
+    void add_all(const Table &from);
+    ObjString* find_string(const char* chars, size_t length, uint32_t hash) const;
+
+    void mark() const;
+    void remove_white();
+
+    int count() const;
+    int capacity() const;
+
+private:
+    Entry* find_entry(ObjString* key);
+    void adjust_capacity(int capacity);
+
+    // Live entries plus tombstones.
+    int m_count {0};
+    std::vector<Entry> m_entries {};
+};
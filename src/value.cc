@@ -1,8 +1,13 @@
+#include <charconv>
+#include <cmath>
+
 #include "value.h"
+#include "output.h"
 #include "objects/object.h"
+#include "objects/objrope.h"
 #include "objects/objstring.h"
 
-
+#ifndef NAN_BOXING
 Value::Value() {
     // std::cout << "VALUE CONSTRUCTED1" << std::endl;
     this->type = VAL_NIL;
@@ -32,31 +37,7 @@ Value::Value(ValueType type, Obj* value) {
     this->type = type;
     this->as.obj = value;
 }
-
-Value::Value(const Value &old) {
-    // std::cout << "VALUE COPIED" << std::endl;
-    this->type = old.type;
-    switch (old.type) {
-        case VAL_OBJ: this->as.obj = old.as.obj->copy(); break;
-        default: this->as.any = old.as.any;
-    }
-}
-
-Value::Value(Value&& other):
-    type {std::move(other.type)},
-    as {std::move(other.as)}
-{
-    // std::cout << "***VALUE MOVED***" << std::endl;
-    other.as.any = nullptr;
-    other.type = VAL_NIL;
-}
-
-Value::~Value() {
-    // std::cout << "VALUE DESTRUCTOR, type: " << type << " ptr: " << (void*) this << std::endl;   
-    // if (type == VAL_OBJ) {
-    //     delete as.obj;
-    // } 
-}
+#endif
 
 std::ostream &operator<<(std::ostream &os, Value const &value) {
     print_value(value, os);
@@ -67,50 +48,61 @@ bool Value::is_falsey() const {
     return IS_NIL(*this) || (IS_BOOL(*this) && !AS_BOOL(*this));
 }
 
-Value& Value::operator=(const Value& other) {
-    this->type = other.type;
-    switch (other.type) {
-        case VAL_OBJ: this->as.obj = other.as.obj->copy(); break;
-        default: this->as.any = other.as.any;
+bool Value::operator==(const Value& other) const {
+    // Ropes compare by content, so flatten them to their interned strings.
+    if (IS_ROPE(*this) || IS_ROPE(other)) {
+        return ObjRope::flattened(*this) == ObjRope::flattened(other);
     }
-    return *this;
-}
 
-Value& Value::operator=(Value&& other){
-    // std::cout << "***VALUE MOVED***" << std::endl;
-    type = std::move(other.type);
-    as = std::move(other.as);
-    other.as.any = nullptr;
-    other.type = VAL_NIL;
-    return *this;
-}
-
-bool Value::operator==(const Value& other) const {
+#ifdef NAN_BOXING
+    // Compare numbers as doubles so that NaN is not equal to itself.
+    if (IS_NUMBER(*this) && IS_NUMBER(other)) {
+        return AS_NUMBER(*this) == AS_NUMBER(other);
+    }
+    // Strings are interned, so equal contents share one object.
+    return bits == other.bits;
+#else
     if (this->type != other.type) return false;
     switch (this->type) {
         case VAL_BOOL:   return AS_BOOL(*this) == AS_BOOL(other);
         case VAL_NIL:    return true;
         case VAL_NUMBER: return AS_NUMBER(*this) == AS_NUMBER(other);
-        case VAL_OBJ: {
-            ObjString * a_string = AS_STRING(*this);
-            ObjString * b_string = AS_STRING(other);
-            return a_string->m_str->compare(*b_string->m_str) == 0;
-        }
+        // Strings are interned, so equal contents share one object.
+        case VAL_OBJ:    return AS_OBJ(*this) == AS_OBJ(other);
         default:         return false; // Unreachable.
     }
+#endif
+}
 
+// Every integer up to here is exactly representable, so the digits are exact.
+#define MAX_PLAIN_INTEGER 9007199254740992.0
+
+int format_number(double number, char* buffer) {
+    char* end = buffer + NUMBER_BUFFER_SIZE;
+    std::to_chars_result result;
+    if (std::trunc(number) == number && std::fabs(number) <= MAX_PLAIN_INTEGER) {
+        result = std::to_chars(buffer, end, number, std::chars_format::fixed);
+    } else {
+        result = std::to_chars(buffer, end, number);
+    }
+    return static_cast<int>(result.ptr - buffer);
 }
 
 template<typename stream_type>
 void print_value(const Value &value, stream_type &output) {
-    switch (value.type) {
-        case VAL_BOOL: output << (AS_BOOL(value) ? "true" : "false"); break;
-        case VAL_NIL: output << "nil"; break;
-        case VAL_NUMBER: output << AS_NUMBER(value); break;
-        case VAL_OBJ: Obj::print_object(value, output); break;
+    if (IS_BOOL(value)) {
+        output << (AS_BOOL(value) ? "true" : "false");
+    } else if (IS_NIL(value)) {
+        output << "nil";
+    } else if (IS_NUMBER(value)) {
+        char buffer[NUMBER_BUFFER_SIZE];
+        output.write(buffer, format_number(AS_NUMBER(value), buffer));
+    } else if (IS_OBJ(value)) {
+        Obj::print_object(value, output);
     }
 }
 
 template void print_value(const Value&, std::ostream&);
 template void print_value(const Value&, std::stringstream&);
+template void print_value(const Value&, OutputBuffer&);
 
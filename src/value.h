@@ -1,23 +1,73 @@
 #pragma once
 
+#include <bit>
 #include <sstream>
 #include <iomanip>
 #include <memory>
+#include <type_traits>
 
 #include "common.h"
 
 struct Obj;
 
+#ifdef NAN_BOXING
+
+// Every non-number is stored in the payload of a quiet NaN. Objects set the
+// sign bit and keep their pointer in the low 48 bits; nil and the booleans
+// use small tags in the lowest bits.
+#define SIGN_BIT ((uint64_t)0x8000000000000000)
+#define QNAN     ((uint64_t)0x7ffc000000000000)
+
+#define TAG_NIL   1 // 01.
+#define TAG_FALSE 2 // 10.
+#define TAG_TRUE  3 // 11.
+
+// A quiet NaN with no tag bits marks a global slot that has not been defined.
+#define TAG_UNDEFINED 0
+
+struct Value {
+    constexpr Value(): bits {QNAN | TAG_NIL} {}
+    constexpr explicit Value(uint64_t bits): bits {bits} {}
+
+    friend std::ostream& operator << (std::ostream &os, const Value &value);
+    bool operator==(const Value& other) const;
+
+    bool is_falsey() const;
+
+    uint64_t bits;
+};
+
+static_assert(sizeof(Value) == sizeof(uint64_t));
+
+#define IS_BOOL(value)    (((value).bits | 1) == (QNAN | TAG_TRUE))
+#define IS_NIL(value)     ((value).bits == (QNAN | TAG_NIL))
+#define IS_NUMBER(value)  (((value).bits & QNAN) != QNAN)
+#define IS_OBJ(value)     (((value).bits & (QNAN | SIGN_BIT)) == (QNAN | SIGN_BIT))
+#define IS_UNDEFINED(value) ((value).bits == (QNAN | TAG_UNDEFINED))
+
+#define AS_BOOL(value)    ((value).bits == (QNAN | TAG_TRUE))
+#define AS_NUMBER(value)  (std::bit_cast<double>((value).bits))
+#define AS_OBJ(value)     ((Obj*)(uintptr_t)((value).bits & ~(SIGN_BIT | QNAN)))
+
+#define BOOL_VAL(value)   (Value {(value) ? (QNAN | TAG_TRUE) : (QNAN | TAG_FALSE)})
+#define NIL_VAL           (Value {QNAN | TAG_NIL})
+#define NUMBER_VAL(value) (Value {std::bit_cast<uint64_t>((double)(value))})
+#define OBJ_VAL(object)   (Value {SIGN_BIT | QNAN | (uint64_t)(uintptr_t)(object)})
+#define UNDEFINED_VAL     (Value {QNAN | TAG_UNDEFINED})
+
+#else
+
 enum ValueType {
     VAL_BOOL,
     VAL_NIL,
     VAL_NUMBER,
     VAL_OBJ,
+    // Never visible to scripts; marks a global slot that has not been defined.
+    VAL_UNDEFINED,
 };
 
 union CastValue {
     constexpr CastValue() {any = nullptr;}
-    ~CastValue() {any = nullptr;} 
     bool boolean;
     double number;
     Obj *obj;
@@ -30,14 +80,9 @@ struct Value {
     Value(ValueType type);
     Value(ValueType type, double value);
     Value(ValueType type, Obj* value);
-    Value(const Value &old);
-    Value(Value&& other);
-    ~Value();
 
     friend std::ostream& operator << (std::ostream &os, const Value &value);
     bool operator==(const Value& other) const;
-    Value& operator=(const Value& other);
-    Value& operator=(Value&& other);
 
     bool is_falsey() const;
 
@@ -50,6 +95,7 @@ struct Value {
 #define IS_NIL(value)     ((value).type == VAL_NIL)
 #define IS_NUMBER(value)  ((value).type == VAL_NUMBER)
 #define IS_OBJ(value)     ((value).type == VAL_OBJ)
+#define IS_UNDEFINED(value) ((value).type == VAL_UNDEFINED)
 
 #define AS_BOOL(value)    ((value).as.boolean)
 #define AS_NUMBER(value)  ((value).as.number)
@@ -59,6 +105,21 @@ struct Value {
 #define NIL_VAL           ((Value){VAL_NIL})
 #define NUMBER_VAL(value) ((Value){VAL_NUMBER, value})
 #define OBJ_VAL(object)   ((Value){VAL_OBJ, (Obj*)object})
+#define UNDEFINED_VAL     ((Value){VAL_UNDEFINED})
+
+#endif
+
+// Values only reference heap objects, so copying one never allocates.
+static_assert(std::is_trivially_copyable_v<Value>);
 
 template<typename stream_type>
-void print_value(const Value &value, stream_type &output);
\ No newline at end of file
+void print_value(const Value &value, stream_type &output);
+
+// Room for the longest number format_number writes, such as
+// "-2.2250738585072014e-308".
+#define NUMBER_BUFFER_SIZE 32
+
+// Writes number into buffer in the fewest digits that read back as the same
+// double and returns the length. Integers up to 2^53 are written out in full,
+// without a decimal point or exponent.
+int format_number(double number, char* buffer);
\ No newline at end of file
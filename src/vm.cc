@@ -1,3 +1,4 @@
+#include <iomanip>
 #include <iostream>
 
 #include <stdarg.h>
@@ -5,11 +6,11 @@
 #include "vm.h"
 #include "common.h"
 #include "compiler.h"
+#include "debug.h"
 #include "objects/object.h"
+#include "objects/objrope.h"
 #include "objects/objstring.h"
 
-#define CHUNK_START (m_chunk->data())
-
 VM::VM() {
     // std::cout << "VM CONSTRUCTED" << std::endl;
     reset_stack();
@@ -26,177 +27,427 @@ void VM::free_objects() {
     while (object != nullptr) {
         // std::cout << "Freeing object at: " << (void*) object << std::endl;
         Obj *next = object->m_next;
-        delete object;
+        Obj::free_object(object);
         object = next;
     }
     m_objects = nullptr;
 }
 
+void VM::mark_roots() {
+    for (Value* slot = m_stack.data(); slot < m_stack_top; slot++) {
+        mark_value(*slot);
+    }
+
+    for (const Value &value : m_global_values) {
+        mark_value(value);
+    }
+    for (ObjString* name : m_global_names) {
+        mark_object(name);
+    }
+    m_global_slots.mark();
+
+    // The compiler writes its constants straight into m_chunk, so this also
+    // covers a chunk that is still being compiled.
+    for (const Value &constant : m_chunk->constants()) {
+        mark_value(constant);
+    }
+}
+
 void VM::reset_stack() {
     m_stack_top = m_stack.data();
 }
 
-InterpretResult VM::interpret(const std::string &source) {
-    Compiler compiler {};
+std::shared_ptr<Chunk> VM::compile(std::string_view source) {
+    Compiler compiler {m_optimization_level, m_print_code};
 
-    //TODO: Remove this to keep state between REPL calls
-    m_chunk = std::make_shared<Chunk>(Chunk {});
+    if (!m_incremental) {
+        m_chunk = std::make_shared<Chunk>(Chunk {});
+    }
+    m_unit_start = m_chunk->size();
 
     if (!compiler.compile(source, m_chunk)) {
+        return nullptr;
+    }
+    return m_chunk;
+}
+
+InterpretResult VM::interpret(std::string_view source) {
+    if (compile(source) == nullptr) {
         return INTERPRET_COMPILE_ERROR;
     }
 
-    m_ip = CHUNK_START; 
+    if (m_backend == BACKEND_REGISTER && !m_trace) {
+        auto register_chunk = std::make_shared<RegisterChunk>();
+        if (lower_to_registers(*m_chunk, *register_chunk, m_unit_start)) {
+            m_register_chunk = register_chunk;
+            if (m_print_code) {
+                std::cerr << disassemble_register_chunk(*m_register_chunk, *m_chunk, "registers").str();
+            }
+            return execute(BACKEND_REGISTER);
+        }
+    }
+
+    m_code = m_chunk->data();
+    m_ip = m_code + m_unit_start;
 
-    InterpretResult result = run();
+    return execute(BACKEND_STACK);
+}
+
+InterpretResult VM::interpret(const MappedBytecode &bytecode) {
+    m_chunk = std::make_shared<Chunk>(Chunk {});
+    m_unit_start = 0;
+
+    std::string error {};
+    if (!bytecode.load(*m_chunk, *this, error)) {
+        std::cerr << error << std::endl;
+        return INTERPRET_COMPILE_ERROR;
+    }
 
+    // The register engine needs the code in the chunk to lower it, so mapped
+    // code always runs on the stack engine.
+    m_code = bytecode.code();
+    m_ip = m_code;
+    return execute(BACKEND_STACK);
+}
+
+InterpretResult VM::execute(Backend backend) {
+    InterpretResult result {};
+    if (m_sampler == nullptr) {
+        if (backend == BACKEND_REGISTER) {
+            result = run_registers<false>();
+        } else {
+            result = m_trace ? run<true, false>() : run<false, false>();
+        }
+    } else {
+        if (backend == BACKEND_REGISTER) {
+            result = run_registers<true>();
+        } else {
+            result = m_trace ? run<true, true>() : run<false, true>();
+        }
+        m_sample_ip = nullptr;
+        m_sampler->drain(m_chunk.get(), m_register_chunk.get());
+    }
+    m_output.flush();
     return result;
 }
 
+template <bool Trace, bool Sampled>
 InterpretResult VM::run() {
-#define READ_BYTE() (*m_ip++)
+    // Keep the instruction pointer in a local so it can live in a register;
+    // m_ip is only synced before anything that reads it.
+    const uint8_t* ip = m_ip;
+    if constexpr (Sampled) {
+        m_sample_code = m_code;
+        m_sample_backend = BACKEND_STACK;
+    }
+
+#define READ_BYTE() (*ip++)
 #define READ_CONSTANT() (m_chunk->constants()[READ_BYTE()])
+#define READ_CONSTANT_LONG() \
+    (ip += 3, m_chunk->constants()[(ip[-3] << 16) | (ip[-2] << 8) | ip[-1]])
 #define READ_SHORT() \
-    (m_ip += 2, (uint16_t)((m_ip[-2] << 8) | m_ip[-1]))
-#define READ_STRING() AS_STRING(READ_CONSTANT())
+    (ip += 2, (uint16_t)((ip[-2] << 8) | ip[-1]))
+#define RUNTIME_ERROR(...) \
+    do { \
+        m_ip = ip; \
+        PROFILE_FINISH(); \
+        runtime_error(__VA_ARGS__); \
+        return INTERPRET_RUNTIME_ERROR; \
+    } while (false)
 #define BINARY_OP(value_type, op) \
     do { \
         if (!IS_NUMBER(peek(0)) || !IS_NUMBER(peek(1))) { \
-            runtime_error("Operands must be numbers."); \
-            return INTERPRET_RUNTIME_ERROR; \
+            RUNTIME_ERROR("Operands must be numbers."); \
         } \
         double b = AS_NUMBER(pop()); \
         double a = AS_NUMBER(pop()); \
         push(value_type(a op b)); \
     } while (false)
+// Pops two numbers and jumps if `condition` over them is false. <= and >= are
+// written as !(a > b) and !(a < b) so NaN compares as it did before they had
+// their own opcodes.
+#define COMPARE_JUMP_IF_FALSE(condition) \
+    do { \
+        uint16_t offset = READ_SHORT(); \
+        if (!IS_NUMBER(peek(0)) || !IS_NUMBER(peek(1))) { \
+            RUNTIME_ERROR("Operands must be numbers."); \
+        } \
+        double b = AS_NUMBER(pop()); \
+        double a = AS_NUMBER(pop()); \
+        if (!(condition)) ip += offset; \
+    } while (false)
+#define LOCAL_CONSTANT_OP(op, message) \
+    do { \
+        const Value &local = m_stack[READ_BYTE()]; \
+        const Value &constant = READ_CONSTANT(); \
+        if (!IS_NUMBER(local)) { \
+            RUNTIME_ERROR(message); \
+        } \
+        push(NUMBER_VAL(AS_NUMBER(local) op AS_NUMBER(constant))); \
+    } while (false)
 
-    for (;;) {
-#ifdef DEBUG_TRACE_EXECUTION
-        for (Value* slot = m_stack.data(); slot < m_stack_top; slot++) {
-            std::cout << "[ " << *slot << " ]";
-        }
-        std::cout << std::endl;
-        disassemble_instruction(*m_chunk, m_ip - CHUNK_START, std::cout);
-        std::cout << std::endl;
+#define TRACE_INSTRUCTION() (Trace ? (m_ip = ip, trace_instruction()) : void())
+
+#define SAMPLE_POINT() (Sampled ? (m_sample_ip = ip, void()) : void())
+
+// Without PROFILE_OPS these leave the dispatch exactly as it was.
+#ifdef PROFILE_OPS
+#define PROFILE_OP(op)    m_op_profile.record(op)
+#define PROFILE_FINISH()  m_op_profile.finish()
+#else
+#define PROFILE_OP(op)    (op)
+#define PROFILE_FINISH()  ((void)0)
 #endif
-        uint8_t instruction {};
-        switch (instruction = READ_BYTE()) {
-            case OP_CONSTANT: {
-                const Value& constant = READ_CONSTANT();
-                push(constant);
-                break;
-            }
-            case OP_NIL:        push(NIL_VAL); break;
-            case OP_TRUE:       push(BOOL_VAL(true)); break;
-            case OP_FALSE:      push(BOOL_VAL(false)); break;
-            case OP_POP:        pop(); break;
-            case OP_GET_LOCAL:  {
-                uint8_t slot = READ_BYTE();
-                push(reinterpret_cast<const Value&>(m_stack[slot]));
-                break;
-            }
-            case OP_SET_LOCAL: {
-                uint8_t slot = READ_BYTE();
-                m_stack[slot] = peek(0);
-                break;
-            }
-            case OP_GET_GLOBAL:  {
-                ObjString* name = READ_STRING();
-                try {
-                    push(reinterpret_cast<const Value&>(m_globals.at(*name->m_str)));
-                } catch (const std::out_of_range&) {
-                    runtime_error("Undefined variable '%s'.", name->m_str->c_str());
-                    return INTERPRET_RUNTIME_ERROR;
-                }
-                break;
-            }
-            case OP_DEFINE_GLOBAL: {
-                ObjString* name = READ_STRING();
-                m_globals[*name->m_str] = peek(0);
-                pop();
-                break;
-            }
-            case OP_SET_GLOBAL: {
-                ObjString* name = READ_STRING();
-                try {
-                    m_globals.at(*name->m_str) = peek(0);
-                } catch (const std::out_of_range &e) {
-                    runtime_error("Undefined variable '%s'.", name->m_str->c_str());
-                    return INTERPRET_RUNTIME_ERROR;
-                }
-                break;
-            }
-            case OP_EQUAL: {
-                Value b = pop();
-                Value a = pop();
-                push(BOOL_VAL(a == b));
-                break;
+
+#ifdef COMPUTED_GOTO
+    // Every handler jumps straight to the next one through this table, which
+    // must list the handlers in OpCode order.
+    static const void* dispatch_table[] = {
+        &&op_OP_CONSTANT,
+        &&op_OP_CONSTANT_LONG,
+        &&op_OP_NIL,
+        &&op_OP_TRUE,
+        &&op_OP_FALSE,
+        &&op_OP_POP,
+        &&op_OP_GET_LOCAL,
+        &&op_OP_SET_LOCAL,
+        &&op_OP_GET_GLOBAL,
+        &&op_OP_SET_GLOBAL,
+        &&op_OP_DEFINE_GLOBAL,
+        &&op_OP_EQUAL,
+        &&op_OP_NOT_EQUAL,
+        &&op_OP_GREATER,
+        &&op_OP_GREATER_EQUAL,
+        &&op_OP_LESS,
+        &&op_OP_LESS_EQUAL,
+        &&op_OP_ADD,
+        &&op_OP_SUBTRACT,
+        &&op_OP_MULTIPLY,
+        &&op_OP_DIVIDE,
+        &&op_OP_NOT,
+        &&op_OP_NEGATE,
+        &&op_OP_PRINT,
+        &&op_OP_JUMP,
+        &&op_OP_JUMP_IF_FALSE,
+        &&op_OP_POP_JUMP_IF_FALSE,
+        &&op_OP_LOOP,
+        &&op_OP_RETURN,
+        &&op_OP_ADD_LOCAL_CONSTANT,
+        &&op_OP_SUBTRACT_LOCAL_CONSTANT,
+        &&op_OP_LESS_JUMP_IF_FALSE,
+        &&op_OP_LESS_EQUAL_JUMP_IF_FALSE,
+        &&op_OP_GREATER_JUMP_IF_FALSE,
+        &&op_OP_GREATER_EQUAL_JUMP_IF_FALSE,
+    };
+    static_assert(sizeof(dispatch_table) / sizeof(dispatch_table[0]) ==
+                  OP_GREATER_EQUAL_JUMP_IF_FALSE + 1);
+
+#define VM_DISPATCH() \
+    do { \
+        TRACE_INSTRUCTION(); \
+        SAMPLE_POINT(); \
+        goto *dispatch_table[PROFILE_OP(READ_BYTE())]; \
+    } while (false)
+#define VM_LOOP     VM_DISPATCH();
+#define VM_CASE(op) op_##op:
+#define VM_NEXT()   VM_DISPATCH()
+#else
+#define VM_LOOP     for (;;) switch (TRACE_INSTRUCTION(), SAMPLE_POINT(), PROFILE_OP(READ_BYTE()))
+#define VM_CASE(op) case op:
+#define VM_NEXT()   break
+#endif
+
+    VM_LOOP {
+        VM_CASE(OP_CONSTANT) {
+            const Value& constant = READ_CONSTANT();
+            push(constant);
+            VM_NEXT();
+        }
+        VM_CASE(OP_CONSTANT_LONG) {
+            const Value& constant = READ_CONSTANT_LONG();
+            push(constant);
+            VM_NEXT();
+        }
+        VM_CASE(OP_NIL)        push(NIL_VAL); VM_NEXT();
+        VM_CASE(OP_TRUE)       push(BOOL_VAL(true)); VM_NEXT();
+        VM_CASE(OP_FALSE)      push(BOOL_VAL(false)); VM_NEXT();
+        VM_CASE(OP_POP)        pop(); VM_NEXT();
+        VM_CASE(OP_GET_LOCAL)  {
+            uint8_t slot = READ_BYTE();
+            push(m_stack[slot]);
+            VM_NEXT();
+        }
+        VM_CASE(OP_SET_LOCAL) {
+            uint8_t slot = READ_BYTE();
+            m_stack[slot] = peek(0);
+            VM_NEXT();
+        }
+        VM_CASE(OP_GET_GLOBAL)  {
+            uint16_t slot = READ_SHORT();
+            const Value &value = m_global_values[slot];
+            if (IS_UNDEFINED(value)) {
+                RUNTIME_ERROR("Undefined variable '%s'.", m_global_names[slot]->chars());
             }
-            case OP_GREATER:    BINARY_OP(BOOL_VAL, >); break;
-            case OP_LESS:       BINARY_OP(BOOL_VAL, <); break;
-            case OP_ADD: {
-                if (IS_STRING(peek(0)) && IS_STRING(peek(1))) {
-                    concatenate();
-                } else if (IS_NUMBER(peek(0)) && IS_NUMBER(peek(1))) {
-                    double b = AS_NUMBER(pop());
-                    double a = AS_NUMBER(pop());
-                    push(NUMBER_VAL(a + b));
-                } else {
-                    runtime_error("Operands must be two numbers or two strings.");
-                    return INTERPRET_RUNTIME_ERROR;
-                }
-                break;
+            push(value);
+            VM_NEXT();
+        }
+        VM_CASE(OP_DEFINE_GLOBAL) {
+            uint16_t slot = READ_SHORT();
+            m_global_values[slot] = peek(0);
+            pop();
+            VM_NEXT();
+        }
+        VM_CASE(OP_SET_GLOBAL) {
+            uint16_t slot = READ_SHORT();
+            if (IS_UNDEFINED(m_global_values[slot])) {
+                RUNTIME_ERROR("Undefined variable '%s'.", m_global_names[slot]->chars());
             }
-            case OP_SUBTRACT:   BINARY_OP(NUMBER_VAL, -); break;
-            case OP_MULTIPLY:   BINARY_OP(NUMBER_VAL, *); break;
-            case OP_DIVIDE:     BINARY_OP(NUMBER_VAL, /); break;
-            case OP_NOT:
-                push(BOOL_VAL(pop().is_falsey()));
-                break;
-            case OP_NEGATE: 
-                if (!IS_NUMBER(peek(0))) {
-                    runtime_error("Operand must be a number.");
-                    return INTERPRET_RUNTIME_ERROR;
-                }    
-                push(NUMBER_VAL(-AS_NUMBER(pop())));
-                break;
-            case OP_PRINT: {
-                print_value(pop(), std::cout);
-                std::cout << std::endl;
-                break;
+            m_global_values[slot] = peek(0);
+            VM_NEXT();
+        }
+        VM_CASE(OP_EQUAL) {
+            // Comparing ropes can allocate, so keep the operands rooted.
+            bool equal = peek(1) == peek(0);
+            pop();
+            pop();
+            push(BOOL_VAL(equal));
+            VM_NEXT();
+        }
+        VM_CASE(OP_NOT_EQUAL) {
+            bool equal = peek(1) == peek(0);
+            pop();
+            pop();
+            push(BOOL_VAL(!equal));
+            VM_NEXT();
+        }
+        VM_CASE(OP_GREATER)    BINARY_OP(BOOL_VAL, >); VM_NEXT();
+        VM_CASE(OP_LESS)       BINARY_OP(BOOL_VAL, <); VM_NEXT();
+        VM_CASE(OP_GREATER_EQUAL) {
+            if (!IS_NUMBER(peek(0)) || !IS_NUMBER(peek(1))) {
+                RUNTIME_ERROR("Operands must be numbers.");
             }
-            case OP_JUMP: {
-                uint16_t offset = READ_SHORT();
-                m_ip += offset;
-                break;
+            double b = AS_NUMBER(pop());
+            double a = AS_NUMBER(pop());
+            push(BOOL_VAL(!(a < b)));
+            VM_NEXT();
+        }
+        VM_CASE(OP_LESS_EQUAL) {
+            if (!IS_NUMBER(peek(0)) || !IS_NUMBER(peek(1))) {
+                RUNTIME_ERROR("Operands must be numbers.");
             }
-            case OP_JUMP_IF_FALSE: {
-                int offset = READ_SHORT();
-                if (peek(0).is_falsey()) {
-                    m_ip += offset;
+            double b = AS_NUMBER(pop());
+            double a = AS_NUMBER(pop());
+            push(BOOL_VAL(!(a > b)));
+            VM_NEXT();
+        }
+        VM_CASE(OP_ADD) {
+            if (IS_TEXT(peek(0)) && IS_TEXT(peek(1))) {
+                if (!concatenate()) {
+                    RUNTIME_ERROR("String too long.");
                 }
-                break;
+            } else if (IS_NUMBER(peek(0)) && IS_NUMBER(peek(1))) {
+                double b = AS_NUMBER(pop());
+                double a = AS_NUMBER(pop());
+                push(NUMBER_VAL(a + b));
+            } else {
+                RUNTIME_ERROR("Operands must be two numbers or two strings.");
             }
-            case OP_LOOP: {
-                int offset = READ_SHORT();
-                m_ip -= offset;
-                break;
+            VM_NEXT();
+        }
+        VM_CASE(OP_SUBTRACT)   BINARY_OP(NUMBER_VAL, -); VM_NEXT();
+        VM_CASE(OP_MULTIPLY)   BINARY_OP(NUMBER_VAL, *); VM_NEXT();
+        VM_CASE(OP_DIVIDE)     BINARY_OP(NUMBER_VAL, /); VM_NEXT();
+        VM_CASE(OP_NOT)
+            push(BOOL_VAL(pop().is_falsey()));
+            VM_NEXT();
+        VM_CASE(OP_NEGATE) 
+            if (!IS_NUMBER(peek(0))) {
+                RUNTIME_ERROR("Operand must be a number.");
+            }    
+            push(NUMBER_VAL(-AS_NUMBER(pop())));
+            VM_NEXT();
+        VM_CASE(OP_PRINT) {
+            print_value(peek(0), m_output);
+            pop();
+            m_output.put('\n');
+            VM_NEXT();
+        }
+        VM_CASE(OP_JUMP) {
+            uint16_t offset = READ_SHORT();
+            ip += offset;
+            VM_NEXT();
+        }
+        VM_CASE(OP_JUMP_IF_FALSE) {
+            int offset = READ_SHORT();
+            if (peek(0).is_falsey()) {
+                ip += offset;
             }
-            case OP_RETURN: {
-                return INTERPRET_OK;
+            VM_NEXT();
+        }
+        VM_CASE(OP_POP_JUMP_IF_FALSE) {
+            int offset = READ_SHORT();
+            if (pop().is_falsey()) {
+                ip += offset;
             }
+            VM_NEXT();
+        }
+        VM_CASE(OP_LOOP) {
+            int offset = READ_SHORT();
+            ip -= offset;
+            VM_NEXT();
+        }
+        VM_CASE(OP_RETURN) {
+            PROFILE_FINISH();
+            return INTERPRET_OK;
         }
+        VM_CASE(OP_ADD_LOCAL_CONSTANT)
+            LOCAL_CONSTANT_OP(+, "Operands must be two numbers or two strings.");
+            VM_NEXT();
+        VM_CASE(OP_SUBTRACT_LOCAL_CONSTANT)
+            LOCAL_CONSTANT_OP(-, "Operands must be numbers.");
+            VM_NEXT();
+        VM_CASE(OP_LESS_JUMP_IF_FALSE)          COMPARE_JUMP_IF_FALSE(a < b); VM_NEXT();
+        VM_CASE(OP_LESS_EQUAL_JUMP_IF_FALSE)    COMPARE_JUMP_IF_FALSE(!(a > b)); VM_NEXT();
+        VM_CASE(OP_GREATER_JUMP_IF_FALSE)       COMPARE_JUMP_IF_FALSE(a > b); VM_NEXT();
+        VM_CASE(OP_GREATER_EQUAL_JUMP_IF_FALSE) COMPARE_JUMP_IF_FALSE(!(a < b)); VM_NEXT();
     }
 #undef READ_BYTE
 #undef READ_SHORT
 #undef READ_CONSTANT
-#undef READ_STRING
+#undef READ_CONSTANT_LONG
+#undef RUNTIME_ERROR
 #undef BINARY_OP
+#undef COMPARE_JUMP_IF_FALSE
+#undef LOCAL_CONSTANT_OP
+#undef TRACE_INSTRUCTION
+#undef SAMPLE_POINT
+#undef PROFILE_OP
+#undef PROFILE_FINISH
+#undef VM_DISPATCH
+#undef VM_LOOP
+#undef VM_CASE
+#undef VM_NEXT
 }
 
-void VM::push(Value &value) {
-    *m_stack_top = std::move(value);
-    m_stack_top++;
+template InterpretResult VM::run<false, false>();
+template InterpretResult VM::run<false, true>();
+template InterpretResult VM::run<true, false>();
+template InterpretResult VM::run<true, true>();
+
+void VM::trace_instruction() {
+    // Keep printed lines in order with the trace around them.
+    m_output.flush();
+    for (Value* slot = m_stack.data(); slot < m_stack_top; slot++) {
+        std::cerr << "[ " << *slot << " ]";
+    }
+    std::cerr << std::endl;
+    // Mapped code is not part of the chunk, so there is nothing to disassemble.
+    if (m_code == m_chunk->data()) {
+        disassemble_instruction(*m_chunk, m_ip - m_code, std::cerr);
+    } else {
+        std::cerr << std::setfill('0') << std::setw(4) << (m_ip - m_code);
+    }
+    std::cerr << std::endl;
 }
 
 void VM::push(const Value &value) {
@@ -214,22 +465,48 @@ Value& VM::peek(int distance) {
 }
 
 void VM::runtime_error(const char* format, ...) {
+    size_t instruction = m_ip - m_code - 1;
     va_list args;
     va_start(args, format);
-    vfprintf(stderr, format, args);
+    report_runtime_error(m_chunk->get_line(instruction), format, args);
     va_end(args);
-    fputs("\n", stderr);
+}
+
+void VM::runtime_error_at(int line, const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    report_runtime_error(line, format, args);
+    va_end(args);
+}
 
-    size_t instruction = m_ip - m_chunk->data() - 1;
-    int line = m_chunk->lines()[instruction];
+void VM::report_runtime_error(int line, const char* format, va_list args) {
+    m_output.flush();
+    vfprintf(stderr, format, args);
+    fputs("\n", stderr);
     fprintf(stderr, "[line %d] in script\n", line);
     reset_stack();
 }
 
-void VM::concatenate() {
-    ObjString* b = AS_STRING(pop());
-    ObjString* a = AS_STRING(pop());
+bool VM::concatenate() {
+    // Leave the operands on the stack so a collection cannot free them.
+    Obj* b = AS_OBJ(peek(0));
+    Obj* a = AS_OBJ(peek(1));
+
+    Obj* result = ObjRope::concatenate(a, b);
+    if (result == nullptr) return false;
+    pop();
+    pop();
+    push(OBJ_VAL(result));
+    return true;
+}
+
+int VM::global_slot(ObjString* name) {
+    Value slot {};
+    if (m_global_slots.get(name, slot)) return (int)AS_NUMBER(slot);
 
-    std::string new_str = *a->m_str + *b->m_str;
-    push(std::move(OBJ_VAL(ObjString::take_string(new_str))));
+    int index = m_global_values.size();
+    m_global_slots.set(name, NUMBER_VAL((double)index));
+    m_global_names.push_back(name);
+    m_global_values.push_back(UNDEFINED_VAL);
+    return index;
 }
\ No newline at end of file
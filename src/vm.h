@@ -1,9 +1,20 @@
 #pragma once
 
 #include <memory>
-#include <unordered_map>
+#include <string_view>
+
+#include <stdarg.h>
 
 #include "chunk.h"
+#include "memory.h"
+#include "register_chunk.h"
+#include "bytecode_file.h"
+#ifdef PROFILE_OPS
+#include "op_profile.h"
+#endif
+#include "output.h"
+#include "sampler.h"
+#include "table.h"
 #include "value.h"
 
 #define STACK_MAX 256
@@ -18,27 +29,99 @@ struct VM {
     VM();
     ~VM();
     void reset_stack();
-    InterpretResult interpret(const std::string &source);
-    InterpretResult run();
-    void push(Value &value);
+    std::shared_ptr<Chunk> compile(std::string_view source);
+    InterpretResult interpret(std::string_view source);
+    InterpretResult interpret(const MappedBytecode &bytecode);
+    // Trace instantiations print the stack and each instruction before it
+    // runs; Sampled ones publish the current instruction in m_sample_ip. The
+    // plain run<false, false>() contains neither.
+    template <bool Trace, bool Sampled> InterpretResult run();
+    template <bool Sampled> InterpretResult run_registers();
+    void trace_instruction();
     void push(const Value &value);
 
     Value& pop();
     Value& peek(int distance);
 
     void runtime_error(const char* format, ...);
+    void runtime_error_at(int line, const char* format, ...);
+
+    // Replaces the two strings or ropes on top of the stack with their
+    // concatenation. Fails, leaving them there, if the result is too long.
+    bool concatenate();
 
-    void concatenate();
+    int global_slot(ObjString* name);
 
+    void mark_roots();
     void free_objects();
 
     Obj* m_objects {nullptr};
-    std::unordered_map<std::string, Value> m_strings {};
-    std::unordered_map<std::string, Value> m_globals {};
+    std::vector<Obj*> m_gray_stack {};
+    size_t m_bytes_allocated {0};
+    size_t m_next_gc {GC_INITIAL_HEAP};
+    // How far the heap may grow past what survived the last collection.
+    double m_gc_grow_factor {GC_HEAP_GROW_FACTOR};
+
+    // 0 runs the bytecode as compiled, anything higher runs the peephole
+    // optimizer over it first.
+    int m_optimization_level {0};
+    // Which interpreter loop runs compiled code. Chunks that do not fit the
+    // register encoding fall back to the stack engine.
+    Backend m_backend {BACKEND_STACK};
+    // REPL sessions keep one chunk for their whole life: each interpret()
+    // appends its code as a new unit behind the previous ones and runs just
+    // that unit. Otherwise every compile starts a fresh chunk.
+    bool m_incremental {false};
+    // --trace: run the traced interpreter loop. The register engine has no
+    // trace, so tracing also runs register code on the stack engine.
+    bool m_trace {false};
+    // --print-code: disassemble everything compiled to stderr.
+    bool m_print_code {false};
+
+    // Published by the sampled interpreter loops for the SIGPROF handler: the
+    // instruction being dispatched, or null outside the loops, and the code
+    // it points into. The handler runs on this thread, so volatile word
+    // stores are enough and keep publishing to a single mov.
+    const void* volatile m_sample_ip {nullptr};
+    const void* volatile m_sample_code {nullptr};
+    volatile Backend m_sample_backend {BACKEND_STACK};
+    // Drained after every run when sampling; see Sampler.
+    Sampler* m_sampler {nullptr};
+
+#ifdef PROFILE_OPS
+    // Filled by run() for every instruction; printed by --profile-ops.
+    OpProfile m_op_profile {};
+#endif
+
+    // Where print goes. Hosts can point it at their own OutputSink; the
+    // interpreter flushes it after every run.
+    OutputBuffer m_output {};
+
+    // Interned strings; only the keys are used.
+    Table m_strings {};
+
+    // Globals are resolved to slots at compile time. m_global_slots maps each
+    // name to its index in m_global_values, which holds UNDEFINED_VAL until the
+    // variable is defined.
+    Table m_global_slots {};
+    std::vector<ObjString*> m_global_names {};
+    std::vector<Value> m_global_values {};
 
 private:
+    void report_runtime_error(int line, const char* format, va_list args);
+    // Runs the loaded code on the given engine, in the sampled loop if a
+    // sampler is attached, then hands the samples to it and flushes what the
+    // code printed.
+    InterpretResult execute(Backend backend);
+
     std::shared_ptr<Chunk> m_chunk;
-    uint8_t* m_ip {nullptr};
+    std::shared_ptr<RegisterChunk> m_register_chunk;
+    // Offset of the code unit added by the last compile().
+    int m_unit_start {0};
+    // Start of the code being run: the chunk's own bytes, or a mapped .loxc
+    // file whose chunk only carries the constants and lines.
+    const uint8_t* m_code {nullptr};
+    const uint8_t* m_ip {nullptr};
     std::vector<Value> m_stack {STACK_MAX};
     Value* m_stack_top {nullptr};
 };
\ No newline at end of file